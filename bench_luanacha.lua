@@ -0,0 +1,295 @@
+-- quick benchmarks of some luanacha functions
+
+local na = require "luanacha"
+
+local strf = string.format
+
+local function bench(name, n, f)
+	-- run f() n times, print the number of calls per second
+	-- (best of 3 runs)
+	local best = 0
+	for run = 1, 3 do
+		local c0 = os.clock()
+		for i = 1, n do f() end
+		local rate = n / (os.clock() - c0)
+		if rate > best then best = rate end
+	end
+	print(strf("%-36s %10.0f /sec", name, best))
+	return best
+end
+
+local function wallbench(name, n, f)
+	-- run f() for about 3 seconds of wall clock time (os.clock() 
+	-- counts the cpu time of all the threads). f() processes n items.
+	-- print the number of items per second
+	local t0 = os.time()
+	while os.time() == t0 do end
+	local count, t1 = 0, os.time()
+	while os.time() - t1 < 3 do f(); count = count + n end
+	local rate = count / (os.time() - t1)
+	print(strf("%-36s %10.0f /sec", name, rate))
+	return rate
+end
+
+print("------------------------------------------------------------")
+print(_VERSION, na.VERSION )
+print("------------------------------------------------------------")
+
+------------------------------------------------------------------------
+-- random generator
+
+bench("randombytes(32)", 200000, function() return na.randombytes(32) end)
+bench("randombytes(64K)", 2000, function() return na.randombytes(65536) end)
+
+------------------------------------------------------------------------
+-- authenticated encryption
+
+do
+	local k, n = na.randombytes(32), na.randombytes(24)
+	for _, size in ipairs{64, 1024 * 1024} do
+		local m = na.randombytes(size)
+		local c = na.lock(k, n, m, n)
+		local count = (size < 1024) and 100000 or 50
+		local r = bench(strf("lock(%d)", size), count, 
+			function() return na.lock(k, n, m, n) end)
+		print(strf("%-36s %10.0f MB/s", "", r * size / 1e6))
+		r = bench(strf("unlock(%d)", size), count, 
+			function() return na.unlock(k, n, c, 24) end)
+		print(strf("%-36s %10.0f MB/s", "", r * size / 1e6))
+	end
+	-- authenticated header: separate blake2b MAC vs lock_aead
+	local hdr = na.randombytes(32)
+	local m = na.randombytes(1024)
+	local r1 = bench("lock(1024) + blake2b(hdr)", 50000, function()
+		local c = na.lock(k, n, m, n)
+		return c, na.blake2b(hdr .. c)
+	end)
+	local r2 = bench("lock_aead(1024, hdr)", 50000, function()
+		return na.lock_aead(k, n, m, hdr, n) end)
+	print(strf("lock_aead speedup: %.2f", r2 / r1))
+	-- encrypted stream, 64 KB chunks
+	local chunk = na.randombytes(65536)
+	local enc = na.encryptor(k)
+	local r = bench("encryptor:update(64K)", 1000, function()
+		return enc:update(chunk) end)
+	print(strf("%-36s %10.0f MB/s", "", r * 65536 / 1e6))
+	-- 300 messages of 200 bytes per call, nonces with a common prefix
+	local ns, ms = {}, {}
+	local prefix = na.randombytes(16)
+	for i = 1, 300 do
+		ns[i] = prefix .. string.char(i % 256, math.floor(i / 256),
+			0, 0, 0, 0, 0, 0) -- (no string.pack before Lua 5.3)
+		ms[i] = na.randombytes(200)
+	end
+	local r1 = bench("lock (200) x300", 200, function()
+		local cs = {}
+		for i = 1, 300 do cs[i] = na.lock(k, ns[i], ms[i]) end
+		return cs
+	end)
+	local r2 = bench("lock_many (200) x300", 200, function()
+		return na.lock_many(k, ns, ms) end)
+	print(strf("%-36s %10.0f msg/sec", "", r2 * 300))
+	print(strf("lock_many speedup: %.2f", r2 / r1))
+	local cs = na.lock_many(k, ns, ms)
+	local r1 = bench("unlock (200) x300", 200, function()
+		local ps = {}
+		for i = 1, 300 do ps[i] = na.unlock(k, ns[i], cs[i]) end
+		return ps
+	end)
+	local r2 = bench("unlock_many (200) x300", 200, function()
+		return na.unlock_many(k, ns, cs) end)
+	print(strf("unlock_many speedup: %.2f", r2 / r1))
+	-- nonce sequence vs random nonce
+	local seq = na.nonce_sequence()
+	local m = na.randombytes(64)
+	local r1 = bench("lock(64), random nonce", 100000, function()
+		local n = na.randombytes(24)
+		return na.lock(k, n, m, n) end)
+	local r2 = bench("lock_auto(64)", 100000, function()
+		return na.lock_auto(k, seq, m) end)
+	print(strf("lock_auto speedup: %.2f", r2 / r1))
+	-- key handle vs key string
+	local kh = na.key(k)
+	local m = na.randombytes(64)
+	local r1 = bench("lock(64), string key", 100000, function()
+		return na.lock(k, n, m) end)
+	local r2 = bench("lock(64), key handle", 100000, function()
+		return na.lock(kh, n, m) end)
+	print(strf("key handle speedup: %.2f", r2 / r1))
+	-- packet loop: one string per packet vs one reused buffer
+	local m = na.randombytes(1024)
+	local r1 = bench("lock+unlock(1024)", 50000, function() 
+		return na.unlock(k, n, na.lock(k, n, m, n), 24) end)
+	local b = na.buffer(24 + 16 + 1024)
+	b:set(1, n)
+	local r2 = bench("lock_into+unlock_into(1024)", 50000, function()
+		b:set(24 + 16 + 1, m)
+		na.lock_into(k, n, b, 24, 1024)
+		return na.unlock_into(k, n, b, 24, 16 + 1024)
+	end)
+	print(strf("buffer speedup: %.2f", r2 / r1))
+	collectgarbage()
+end
+
+------------------------------------------------------------------------
+-- key generation
+
+local r1 = bench("x25519_keypair", 2000, na.x25519_keypair)
+bench("sign_keypair", 2000, na.sign_keypair)
+
+-- key pairs taken from a full pool (the pool is not refilled while 
+-- it is more than half full)
+na.keypair_pool(2048)
+while select(3, na.keypair_pool()) < 4096 do end
+local r2 = bench("x25519_keypair (from pool)", 300, na.x25519_keypair)
+print(strf("keypair_pool speedup: %.2f", r2 / r1))
+na.keypair_pool(0)
+
+------------------------------------------------------------------------
+-- ed25519 signature
+
+local t = "The quick brown fox jumps over the lazy dog"
+local pk, sk = na.sign_keypair()
+local signer = na.signer(sk)
+
+local r1 = bench("sign", 500, function() na.sign(sk, pk, t) end)
+local r2 = bench("signer:sign", 500, function() signer:sign(t) end)
+print(strf("signer speedup: %.2f", r2 / r1))
+-- multi-buffer signing, on the calling thread only
+local ms64 = {}
+for i = 1, 64 do ms64[i] = t .. i end
+local nthreads = na.workpool(0)
+local r3 = bench("sign_many (64, 1 thread)", 10, function() 
+	na.sign_many(signer, ms64) 
+	end) * 64
+print(strf("%-36s %10.0f /sec", "  => signatures", r3))
+print(strf("sign_many speedup (1 thread): %.2f", r3 / r2))
+na.workpool(nthreads)
+
+local big = ("0123456789abcdef"):rep(65536) -- 1 MB
+local r1 = bench("sign (1 MB)", 20, function() signer:sign(big) end)
+local r2 = bench("sign_ph (1 MB)", 20, function() na.sign_ph(signer, big) end)
+local r3 = bench("blake2b (1 MB)", 20, function() na.blake2b(big) end)
+print(strf("sign_ph speedup: %.2f  (sign_ph / blake2b: %.2f)", 
+	r2 / r1, r2 / r3))
+
+------------------------------------------------------------------------
+-- ed25519 signature verification
+
+local sigs, pks, ms = {}, {}, {}
+for i = 1, 64 do
+	local pk, sk = na.sign_keypair()
+	local m = t .. i
+	sigs[i], pks[i], ms[i] = na.sign(sk, pk, m), pk, m
+end
+
+local r1 = bench("check (x64)", 50, function()
+	for i = 1, 64 do na.check(sigs[i], pks[i], ms[i]) end
+	end)
+local r2 = bench("check_batch (64)", 50, function()
+	na.check_batch(sigs, pks, ms)
+	end)
+print(strf("check_batch speedup: %.2f", r2 / r1))
+
+local vs = {}
+for i = 1, 64 do vs[i] = na.verifier(pks[i]) end
+local r3 = bench("verifier:check (x64)", 50, function()
+	for i = 1, 64 do vs[i]:check(sigs[i], ms[i]) end
+	end)
+print(strf("verifier speedup: %.2f", r3 / r1))
+
+local cc = na.check_cache()
+local r4 = bench("check_cache:check (x64, hits)", 50, function()
+	for i = 1, 64 do cc:check(sigs[i], pks[i], ms[i]) end
+	end)
+print(strf("check_cache speedup (hits): %.2f", r4 / r1))
+
+-- verifier warm-up: decompress 64 keys, or load them from a key store
+local ksname = os.tmpname()
+os.remove(ksname)
+local kst = na.randombytes(32)
+na.keystore_build(kst, ksname, pks)
+na.verifier_cache(0)
+local r1 = bench("verifier (x64, no cache)", 20, function()
+	for i = 1, 64 do na.verifier(pks[i]) end
+	end)
+local r2 = bench("keystore + ks:verifier (x64)", 20, function()
+	local ks = na.keystore(kst, ksname)
+	for i = 1, 64 do ks:verifier(pks[i]) end
+	end)
+print(strf("keystore speedup: %.2f", r2 / r1))
+na.verifier_cache(256)
+os.remove(ksname)
+
+------------------------------------------------------------------------
+-- parallel signature and verification (wall clock time)
+
+local nthreads, grain = na.workpool()
+print(strf("worker threads: %d, grain: %d", nthreads, grain))
+local ms1k, ts = {}, {}
+for i = 1, 1024 do
+	ms1k[i] = t .. i
+	ts[i] = {sigs[i % 64 + 1], pks[i % 64 + 1], ms[i % 64 + 1]}
+end
+local r1 = wallbench("signer:sign (x1024)", 1024, function()
+	for i = 1, 1024 do signer:sign(ms1k[i]) end
+	end)
+local r2 = wallbench("sign_many (1024)", 1024, function()
+	na.sign_many(signer, ms1k)
+	end)
+print(strf("sign_many speedup: %.2f", r2 / r1))
+local r1 = wallbench("check (x1024)", 1024, function()
+	for i = 1, 1024 do na.check(ts[i][1], ts[i][2], ts[i][3]) end
+	end)
+local r2 = wallbench("check_many (1024)", 1024, function()
+	na.check_many(ts)
+	end)
+print(strf("check_many speedup: %.2f", r2 / r1))
+
+local big = na.randombytes(65536):rep(256) -- 16 MB
+local k, n = na.randombytes(32), na.randombytes(24)
+local cbig = na.lock_parallel(k, n, big)
+local r1 = wallbench("lock (16 MB)", 16, function()
+	na.lock(k, n, big)
+	end)
+local r2 = wallbench("lock_parallel (16 MB)", 16, function()
+	na.lock_parallel(k, n, big)
+	end)
+print(strf("lock_parallel speedup: %.2f", r2 / r1))
+wallbench("unlock_parallel (16 MB)", 16, function()
+	na.unlock_parallel(k, n, cbig)
+	end)
+
+-- 4 KB from the middle of a 16 MB encrypted file
+local fname = os.tmpname()
+na.seekfile_write(k, fname, big)
+local sf = na.seekfile(k, fname)
+local clocked = na.lock(k, n, big)
+local r1 = bench("unlock (16 MB) for 4 KB", 20, function()
+	return na.unlock(k, n, clocked):sub(8000001, 8004096)
+	end)
+local r2 = bench("seekfile:read (4 KB)", 20000, function()
+	return sf:read(8000000, 4096)
+	end)
+print(strf("seekfile speedup: %.2f", r2 / r1))
+sf:close()
+os.remove(fname)
+
+------------------------------------------------------------------------
+-- asynchronous jobs (wall clock time)
+
+print(strf("async threads: %d", na.async_threads()))
+local r1 = wallbench("argon2i (1 MB, x8)", 8, function()
+	for i = 1, 8 do na.argon2i("pw", "salt salt", 1000, 3) end
+	end)
+local r2 = wallbench("async argon2i (1 MB, 8 jobs)", 8, function()
+	local fs = {}
+	for i = 1, 8 do fs[i] = na.async("argon2i", "pw", "salt salt", 1000, 3) end
+	for i = 1, 8 do fs[i]:result() end
+	end)
+print(strf("async argon2i speedup: %.2f", r2 / r1))
+bench("async blake2b round trip", 20000, function()
+	return na.async("blake2b", t):result()
+	end)
+
+print("------------------------------------------------------------")
@@ -0,0 +1,386 @@
+// Copyright (c) 2018  Phil Leblanc  -- see LICENSE file
+// ---------------------------------------------------------------------
+
+// a pool of native threads for asynchronous jobs
+
+// asyncpool_submit() queues a job and returns at once. A worker
+// thread calls job->run(job, &local), then marks the job done and
+// signals the completion on a file descriptor (an eventfd on Linux,
+// else a pipe) which an event loop can poll: asyncpool_fd().
+// asyncpool_ack() clears it and returns the number of jobs completed
+// since the previous call.
+//
+// 'local' is a per-thread pointer, initially NULL, which run() can
+// use to keep a context between jobs. It is passed to the cleanup
+// function (asyncpool_cleanup()) when the thread stops.
+//
+// A job which is abandoned by its owner (asyncpool_abandon()) is
+// freed with job->free(job) as soon as it is done.
+//
+// Threads are started on the first submitted job. They are stopped
+// when the number of threads is changed, and when the last user
+// releases the pool (asyncpool_release()). Jobs submitted before a
+// fork() which were not done yet are never done in the child process:
+// asyncpool_wait() returns -1 at once for them, asyncpool_done()
+// returns 1 and asyncpool_abandon() frees them.
+//
+// The jobs are kept in one FIFO queue behind the pool lock, not in
+// per-thread work-stealing deques: all the jobs are submitted by the
+// calling thread (a job never submits another job: the functions
+// allowed in async() cannot call async()), so there is no locality
+// for a worker's own deque to keep, and every job would be stolen.
+// Each job (a function call in a private Lua state, with its
+// arguments and results copied) is long compared with the queue
+// operations, so the single lock is not contended. A FIFO also runs
+// the jobs in the order they are submitted.
+
+#include <stddef.h>
+
+#define ASYNC_QUEUED 0
+#define ASYNC_RUNNING 1
+#define ASYNC_DONE 2
+#define ASYNCPOOL_MAX_THREADS 64
+
+typedef struct async_job {
+	struct async_job *next;
+	void (*run)(struct async_job *job, void **local);
+	void (*free)(struct async_job *job);
+	int state;
+	int abandoned;
+	long pid;	// process which submitted the job
+} async_job;
+
+typedef void (*async_cleanup_fn)(void *local);
+
+static async_cleanup_fn pool_cleanup = NULL;
+
+void asyncpool_cleanup(async_cleanup_fn cleanup) {
+	pool_cleanup = cleanup;
+}
+
+#ifdef _WIN32
+
+// ---------------------------------------------------------------------
+// no threads on windows - jobs are run when they are submitted
+
+static long pool_completed = 0;
+
+int asyncpool_submit(async_job *job) {
+	void *local = NULL;
+	job->state = ASYNC_RUNNING;
+	job->run(job, &local);
+	if ((local != NULL) && (pool_cleanup != NULL)) pool_cleanup(local);
+	job->state = ASYNC_DONE;
+	pool_completed++;
+	return 0;
+}
+
+int asyncpool_done(async_job *job) { return job->state == ASYNC_DONE; }
+int asyncpool_wait(async_job *job) { return 0; }
+void asyncpool_abandon(async_job *job) { job->free(job); }
+int asyncpool_fd(void) { return -1; }
+
+long asyncpool_ack(void) {
+	long n = pool_completed;
+	pool_completed = 0;
+	return n;
+}
+
+int asyncpool_threads(int n) { return 0; }
+void asyncpool_retain(void) { }
+void asyncpool_release(void) { }
+
+#else // unix
+// ---------------------------------------------------------------------
+// pthreads
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t pool_threads[ASYNCPOOL_MAX_THREADS];
+static int pool_running = 0;	// number of started threads
+static int pool_size = -1;  	// number of threads to start (-1: auto)
+static int pool_refs = 0;
+static int pool_stopping = 0;
+static pid_t pool_pid;      	// process which started the threads
+
+static async_job *queue_head = NULL, *queue_tail = NULL;
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+// completion signal: an eventfd (fds[0] == fds[1]) or a pipe
+static int fds[2] = {-1, -1};
+
+static void open_fd(void) {
+	// called with pool_lock
+	if (fds[0] >= 0) return;
+#ifdef __linux__
+	fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fds[0] >= 0) return;
+#endif
+	if (pipe(fds) != 0) {
+		fds[0] = fds[1] = -1;
+		return;
+	}
+	for (int i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+}
+
+static void signal_fd(void) {
+	// called with pool_lock
+	if (fds[1] < 0) return;
+	if (fds[0] == fds[1]) {
+		uint64_t one = 1;
+		if (write(fds[1], &one, 8) != 8) { } // counter overflow: ignored
+	} else {
+		char c = 1;
+		if (write(fds[1], &c, 1) != 1) { } // pipe full: still readable
+	}
+}
+
+static void *worker(void *unused) {
+	void *local = NULL;
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (!pool_stopping && (queue_head == NULL)) {
+			pthread_cond_wait(&work_cond, &pool_lock);
+		}
+		if (pool_stopping) break;
+		async_job *job = queue_head;
+		queue_head = job->next;
+		if (queue_head == NULL) queue_tail = NULL;
+		job->state = ASYNC_RUNNING;
+		pthread_mutex_unlock(&pool_lock);
+		job->run(job, &local);
+		pthread_mutex_lock(&pool_lock);
+		job->state = ASYNC_DONE;
+		if (job->abandoned) {
+			job->free(job);
+		} else {
+			pthread_cond_broadcast(&done_cond);
+			signal_fd();
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+	if ((local != NULL) && (pool_cleanup != NULL)) pool_cleanup(local);
+	return NULL;
+}
+
+static int default_size(void) {
+	// one thread per additional cpu, at least one (the calling thread
+	// does not run the jobs)
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 2) ncpu = 2;
+	if (ncpu > ASYNCPOOL_MAX_THREADS) ncpu = ASYNCPOOL_MAX_THREADS + 1;
+	return (int)ncpu - 1;
+}
+
+static void check_fork(void) {
+	// called with pool_lock. after a fork(), the threads and the
+	// jobs of the parent do not exist in the child
+	if ((pool_running == 0) || (pool_pid == getpid())) return;
+	pool_running = 0;
+	queue_head = queue_tail = NULL;
+}
+
+static int forked(async_job *job) {
+	// return 1 if the job was submitted by the parent process and was
+	// not done at the fork(): no thread of this process will run it.
+	// (pid is not changed after the submission, and in the child,
+	// no thread can change the state of the job)
+	return (job->pid != (long) getpid()) && (job->state != ASYNC_DONE);
+}
+
+// the lock is held across fork(), so that it is not copied in the
+// child while a worker holds it. The child has only one thread when
+// fork_child() runs: the condition variables (which may have had
+// threads of the parent as waiters) can be re-initialized.
+
+static void fork_prepare(void) { pthread_mutex_lock(&pool_lock); }
+static void fork_parent(void) { pthread_mutex_unlock(&pool_lock); }
+
+static void fork_child(void) {
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+static void register_atfork(void) {
+	pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+static int start_threads(void) {
+	// called with pool_lock. return the number of running threads
+	int n = (pool_size < 0) ? default_size() : pool_size;
+	check_fork();
+	pool_pid = getpid();
+	while (pool_running < n) {
+		if (pthread_create(&pool_threads[pool_running], NULL,
+				worker, NULL) != 0) break; // run with fewer threads
+		pool_running++;
+	}
+	return pool_running;
+}
+
+static void stop_threads(void) {
+	// called with pool_lock
+	check_fork();
+	if (pool_running == 0) return;
+	pool_stopping = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&pool_lock);
+	for (int i = 0; i < pool_running; i++) {
+		pthread_join(pool_threads[i], NULL);
+	}
+	pthread_mutex_lock(&pool_lock);
+	pool_running = 0;
+	pool_stopping = 0;
+}
+
+int asyncpool_submit(async_job *job) {
+	// queue a job. return 0, or -1 if no thread can be started
+	int r = 0;
+	job->next = NULL;
+	job->state = ASYNC_QUEUED;
+	job->abandoned = 0;
+	job->pid = (long) getpid();
+	pthread_once(&atfork_once, register_atfork);
+	pthread_mutex_lock(&pool_lock);
+	open_fd();
+	if (start_threads() == 0) {
+		r = -1;
+	} else {
+		if (queue_tail == NULL) queue_head = job;
+		else queue_tail->next = job;
+		queue_tail = job;
+		pthread_cond_signal(&work_cond);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return r;
+}
+
+int asyncpool_done(async_job *job) {
+	if (forked(job)) return 1;
+	pthread_mutex_lock(&pool_lock);
+	int done = (job->state == ASYNC_DONE);
+	pthread_mutex_unlock(&pool_lock);
+	return done;
+}
+
+int asyncpool_wait(async_job *job) {
+	// wait until the job is done. return 0, or -1 if the job was
+	// submitted before a fork() and will never be done in this process
+	if (forked(job)) return -1;
+	pthread_mutex_lock(&pool_lock);
+	while (job->state != ASYNC_DONE) {
+		pthread_cond_wait(&done_cond, &pool_lock);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return 0;
+}
+
+void asyncpool_abandon(async_job *job) {
+	// the owner does not need the job anymore. It is freed now if it
+	// is done or still queued, else by the worker when it is done
+	// (a job of the parent process is not used by any thread)
+	if (forked(job)) {
+		job->free(job);
+		return;
+	}
+	pthread_mutex_lock(&pool_lock);
+	if (job->state == ASYNC_QUEUED) {
+		// remove the job from the queue
+		async_job **p = &queue_head, *prev = NULL;
+		while ((*p != NULL) && (*p != job)) {
+			prev = *p;
+			p = &(*p)->next;
+		}
+		if (*p == job) {
+			*p = job->next;
+			if (queue_tail == job) queue_tail = prev;
+		}
+		job->state = ASYNC_DONE;
+	}
+	if (job->state == ASYNC_DONE) job->free(job);
+	else job->abandoned = 1;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+int asyncpool_fd(void) {
+	// return the completion file descriptor (readable when jobs are
+	// done), or -1
+	pthread_mutex_lock(&pool_lock);
+	open_fd();
+	int fd = fds[0];
+	pthread_mutex_unlock(&pool_lock);
+	return fd;
+}
+
+long asyncpool_ack(void) {
+	// clear the completion file descriptor. return the number of
+	// jobs completed since the previous call
+	long n = 0;
+	pthread_mutex_lock(&pool_lock);
+	if (fds[0] >= 0) {
+		if (fds[0] == fds[1]) {
+			uint64_t count;
+			if (read(fds[0], &count, 8) == 8) n = (long) count;
+		} else {
+			char buf[256];
+			ssize_t r;
+			while ((r = read(fds[0], buf, sizeof(buf))) > 0) n += r;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return n;
+}
+
+int asyncpool_threads(int n) {
+	// set the number of threads (n < 0: only return the current
+	// value). return the previous number of threads
+	pthread_mutex_lock(&pool_lock);
+	int old = (pool_size < 0) ? default_size() : pool_size;
+	if (n >= 0) {
+		if (n > ASYNCPOOL_MAX_THREADS) n = ASYNCPOOL_MAX_THREADS;
+		if (n == 0) n = 1;
+		stop_threads(); // queued jobs are run by the new threads
+		pool_size = n;
+		if (queue_head != NULL) start_threads();
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return old;
+}
+
+void asyncpool_retain(void) {
+	pthread_mutex_lock(&pool_lock);
+	pool_refs++;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void asyncpool_release(void) {
+	// the threads must be stopped before the library is unloaded
+	pthread_mutex_lock(&pool_lock);
+	if (--pool_refs == 0) {
+		stop_threads();
+		if (fds[0] >= 0) {
+			close(fds[0]);
+			if (fds[1] != fds[0]) close(fds[1]);
+			fds[0] = fds[1] = -1;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+#endif  // win32 or unix?
@@ -0,0 +1,168 @@
+// Copyright (c) 2018  Phil Leblanc  -- see LICENSE file
+// ---------------------------------------------------------------------
+
+// a guarded arena for secret keys
+
+// keyarena_alloc() returns a 32-byte slot for a secret key, and
+// keyarena_free() wipes and releases it. The slots are taken from
+// chunks of memory which are locked in RAM (mlock, so that keys are
+// never written to swap), excluded from core dumps when possible,
+// and surrounded by inaccessible guard pages (an overflow of a buffer
+// next to the arena faults instead of reading or writing keys).
+//
+// Locking may fail (eg. RLIMIT_MEMLOCK is too low). The keys are then
+// still in the arena, but not locked: keyarena_stats() tells whether
+// all the chunks are locked.
+
+#include <stddef.h>
+#include <string.h>
+#include "monocypher.h"
+
+#define KEYARENA_SLOT 32
+
+#ifdef _WIN32
+
+// ---------------------------------------------------------------------
+// no guard pages or locking on windows - slots are allocated
+
+#include <stdlib.h>
+
+static int arena_count = 0;
+
+unsigned char *keyarena_alloc(void) {
+	unsigned char *slot = malloc(KEYARENA_SLOT);
+	if (slot != NULL) arena_count++;
+	return slot;
+}
+
+void keyarena_free(unsigned char *slot) {
+	if (slot == NULL) return;
+	crypto_wipe(slot, KEYARENA_SLOT);
+	free(slot);
+	arena_count--;
+}
+
+void keyarena_stats(int *count, int *locked) {
+	*count = arena_count;
+	*locked = 0;
+}
+
+#else // unix
+// ---------------------------------------------------------------------
+// mmap, mprotect and mlock
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+typedef struct chunk {
+	struct chunk *next;
+	unsigned char *base;	// guard page, slots, guard page
+	unsigned char *slots;	// first slot (after the first guard page)
+	size_t nslots;
+	size_t used;
+	int locked;         	// 1 if the slots are locked in RAM
+	unsigned char *inuse;	// one flag per slot
+} chunk;
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static chunk *chunks = NULL;
+static int arena_count = 0;
+
+static chunk *new_chunk(void) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	chunk *ch = malloc(sizeof(chunk) + page / KEYARENA_SLOT);
+	if (ch == NULL) return NULL;
+	ch->base = mmap(NULL, 3 * page, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ch->base == MAP_FAILED) {
+		free(ch);
+		return NULL;
+	}
+	ch->slots = ch->base + page;
+	if (mprotect(ch->slots, page, PROT_READ | PROT_WRITE) != 0) {
+		munmap(ch->base, 3 * page);
+		free(ch);
+		return NULL;
+	}
+	ch->locked = (mlock(ch->slots, page) == 0);
+#ifdef MADV_DONTDUMP
+	madvise(ch->slots, page, MADV_DONTDUMP);
+#endif
+	ch->nslots = page / KEYARENA_SLOT;
+	ch->used = 0;
+	ch->inuse = (unsigned char *) (ch + 1);
+	memset(ch->inuse, 0, ch->nslots);
+	ch->next = chunks;
+	chunks = ch;
+	return ch;
+}
+
+static void free_chunk(chunk *ch) {
+	// called with arena_lock. the slots are already wiped
+	size_t page = sysconf(_SC_PAGESIZE);
+	chunk **p = &chunks;
+	while (*p != ch) p = &(*p)->next;
+	*p = ch->next;
+	if (ch->locked) munlock(ch->slots, page);
+	munmap(ch->base, 3 * page);
+	free(ch);
+}
+
+unsigned char *keyarena_alloc(void) {
+	// return a slot of KEYARENA_SLOT bytes, or NULL
+	unsigned char *slot = NULL;
+	pthread_mutex_lock(&arena_lock);
+	chunk *ch = chunks;
+	while ((ch != NULL) && (ch->used == ch->nslots)) ch = ch->next;
+	if (ch == NULL) ch = new_chunk();
+	if (ch != NULL) {
+		size_t i = 0;
+		while (ch->inuse[i]) i++;
+		ch->inuse[i] = 1;
+		ch->used++;
+		arena_count++;
+		slot = ch->slots + i * KEYARENA_SLOT;
+	}
+	pthread_mutex_unlock(&arena_lock);
+	return slot;
+}
+
+void keyarena_free(unsigned char *slot) {
+	// wipe and release a slot. Empty chunks are unmapped, except the
+	// last one
+	if (slot == NULL) return;
+	crypto_wipe(slot, KEYARENA_SLOT);
+	pthread_mutex_lock(&arena_lock);
+	chunk *ch = chunks;
+	while ((slot < ch->slots) ||
+			(slot >= ch->slots + ch->nslots * KEYARENA_SLOT)) {
+		ch = ch->next;
+	}
+	ch->inuse[(slot - ch->slots) / KEYARENA_SLOT] = 0;
+	ch->used--;
+	arena_count--;
+	if ((ch->used == 0) && ((ch != chunks) || (ch->next != NULL))) {
+		free_chunk(ch);
+	}
+	pthread_mutex_unlock(&arena_lock);
+}
+
+void keyarena_stats(int *count, int *locked) {
+	// count: number of slots in use
+	// locked: 1 if all the chunks are locked in RAM
+	pthread_mutex_lock(&arena_lock);
+	*count = arena_count;
+	*locked = 1;
+	for (chunk *ch = chunks; ch != NULL; ch = ch->next) {
+		if (!ch->locked) *locked = 0;
+	}
+	pthread_mutex_unlock(&arena_lock);
+}
+
+#endif  // win32 or unix?
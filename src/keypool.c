@@ -0,0 +1,250 @@
+// Copyright (c) 2018  Phil Leblanc  -- see LICENSE file
+// ---------------------------------------------------------------------
+
+// a pool of precomputed key pairs, refilled by a background thread
+
+// There is one pool for x25519 key pairs and one for ed25519 key
+// pairs. keypool_pop() takes a key pair from a pool in O(1), and
+// returns -1 if the pool is empty (the caller then generates the
+// key pair itself). The background thread refills a pool when it is
+// less than half full, by batches of KEYPOOL_BATCH key pairs (one
+// call to randombytes() per batch).
+//
+// The pools are disabled (size 0) until keypool_resize() is called.
+// Unused key pairs are wiped when the pools are resized, after a
+// fork() (in the child, so that the parent and the child never use
+// the same key pair), and when the last user releases the pools.
+
+#include <stddef.h>
+#include <string.h>
+#include "monocypher.h"
+
+#define KEYPOOL_X25519 0
+#define KEYPOOL_SIGN 1
+#define KEYPOOL_MAX (1 << 16)	// max number of key pairs per pool
+#define KEYPOOL_BATCH 16
+
+extern int randombytes(unsigned char *x,unsigned long long xlen);
+
+#ifdef _WIN32
+
+// ---------------------------------------------------------------------
+// no background thread on windows - the pools are always empty
+
+int keypool_pop(int kind, unsigned char pk[32], unsigned char sk[32]) {
+	return -1;
+}
+
+int keypool_resize(int size) { return -1; }
+
+void keypool_stats(long *hits, long *misses, int *count) {
+	*hits = *misses = 0;
+	*count = 0;
+}
+
+void keypool_retain(void) { }
+void keypool_release(void) { }
+
+#else // unix
+// ---------------------------------------------------------------------
+// pthreads
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef struct {
+	unsigned char pk[32];
+	unsigned char sk[32];
+} keypair;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t refill_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t pool_thread;
+static int pool_running = 0;
+static int pool_stopping = 0;
+static pid_t pool_pid = 0;  	// process which filled the pools
+static int pool_refs = 0;
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static keypair *pools[2];   	// pool_size key pairs each
+static int counts[2];       	// number of key pairs in each pool
+static int pool_size = 0;
+static long pool_hits = 0, pool_misses = 0;
+
+static void make_keypairs(int kind, keypair *kps, int n) {
+	// generate n key pairs, with a single call to randombytes()
+	unsigned char sks[KEYPOOL_BATCH * 32];
+	if (randombytes(sks, n * 32) != 0) abort(); // no key without entropy
+	for (int i = 0; i < n; i++) {
+		unsigned char *sk = sks + i * 32;
+		memcpy(kps[i].sk, sk, 32);
+		if (kind == KEYPOOL_X25519) crypto_x25519_public_key(kps[i].pk, sk);
+		else crypto_sign_public_key(kps[i].pk, sk);
+	}
+	crypto_wipe(sks, sizeof(sks));
+}
+
+static void *refill(void *unused) {
+	keypair batch[KEYPOOL_BATCH];
+	pthread_mutex_lock(&pool_lock);
+	while (!pool_stopping) {
+		// refill the least filled pool
+		int kind = (counts[KEYPOOL_SIGN] < counts[KEYPOOL_X25519]) ?
+			KEYPOOL_SIGN : KEYPOOL_X25519;
+		int n = pool_size - counts[kind];
+		if (n == 0) {
+			pthread_cond_wait(&refill_cond, &pool_lock);
+			continue;
+		}
+		if (n > KEYPOOL_BATCH) n = KEYPOOL_BATCH;
+		pthread_mutex_unlock(&pool_lock);
+		make_keypairs(kind, batch, n);
+		pthread_mutex_lock(&pool_lock);
+		memcpy(pools[kind] + counts[kind], batch, n * sizeof(keypair));
+		counts[kind] += n;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	crypto_wipe(batch, sizeof(batch));
+	return NULL;
+}
+
+static void free_pools(void) {
+	// called with pool_lock, the thread is stopped
+	for (int kind = 0; kind < 2; kind++) {
+		if (pools[kind] == NULL) continue;
+		crypto_wipe(pools[kind], pool_size * sizeof(keypair));
+		free(pools[kind]);
+		pools[kind] = NULL;
+		counts[kind] = 0;
+	}
+	pool_size = 0;
+}
+
+static void stop_thread(void) {
+	// called with pool_lock
+	if (pool_running && (pool_pid == getpid())) {
+		pool_stopping = 1;
+		pthread_cond_signal(&refill_cond);
+		pthread_mutex_unlock(&pool_lock);
+		pthread_join(pool_thread, NULL);
+		pthread_mutex_lock(&pool_lock);
+		pool_stopping = 0;
+	}
+	pool_running = 0;
+}
+
+static void check_fork(void) {
+	// called with pool_lock. In a child process, the key pairs are
+	// also in the parent pools: drop them, and restart the thread
+	if (pool_pid == getpid()) return;
+	pool_pid = getpid();
+	if (pool_running) {
+		pool_running = 0; // the thread does not exist in the child
+		for (int kind = 0; kind < 2; kind++) {
+			crypto_wipe(pools[kind], pool_size * sizeof(keypair));
+			counts[kind] = 0;
+		}
+		if (pthread_create(&pool_thread, NULL, refill, NULL) == 0) {
+			pool_running = 1;
+		} else {
+			free_pools();
+		}
+	}
+}
+
+// the lock is held across fork(), so that it is not copied in the
+// child while the refill thread holds it. The child has only one
+// thread when fork_child() runs: the condition variable (which may
+// have had the parent thread as a waiter) can be re-initialized.
+
+static void fork_prepare(void) { pthread_mutex_lock(&pool_lock); }
+static void fork_parent(void) { pthread_mutex_unlock(&pool_lock); }
+
+static void fork_child(void) {
+	pthread_cond_init(&refill_cond, NULL);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+static void register_atfork(void) {
+	pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+int keypool_pop(int kind, unsigned char pk[32], unsigned char sk[32]) {
+	// take a key pair from a pool. return 0, or -1 if the pool is
+	// empty
+	int r = -1;
+	pthread_mutex_lock(&pool_lock);
+	check_fork();
+	if (counts[kind] > 0) {
+		keypair *kp = pools[kind] + --counts[kind];
+		memcpy(pk, kp->pk, 32);
+		memcpy(sk, kp->sk, 32);
+		crypto_wipe(kp, sizeof(keypair));
+		if (counts[kind] < pool_size / 2 + 1) {
+			pthread_cond_signal(&refill_cond);
+		}
+		pool_hits++;
+		r = 0;
+	} else if (pool_size > 0) {
+		pool_misses++;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return r;
+}
+
+int keypool_resize(int size) {
+	// set the size of the pools (0 disables them). The pools are
+	// emptied. return 0, or -1 if the pools cannot be allocated or
+	// the thread cannot be started
+	int r = 0;
+	if (size > KEYPOOL_MAX) size = KEYPOOL_MAX;
+	pthread_once(&atfork_once, register_atfork);
+	pthread_mutex_lock(&pool_lock);
+	stop_thread();
+	free_pools();
+	if (size > 0) {
+		pools[0] = malloc(size * sizeof(keypair));
+		pools[1] = malloc(size * sizeof(keypair));
+		pool_size = size;
+		pool_pid = getpid();
+		if ((pools[0] == NULL) || (pools[1] == NULL) ||
+			(pthread_create(&pool_thread, NULL, refill, NULL) != 0)) {
+			free_pools();
+			r = -1;
+		} else {
+			pool_running = 1;
+		}
+	}
+	pool_hits = pool_misses = 0;
+	pthread_mutex_unlock(&pool_lock);
+	return r;
+}
+
+void keypool_stats(long *hits, long *misses, int *count) {
+	pthread_mutex_lock(&pool_lock);
+	*hits = pool_hits;
+	*misses = pool_misses;
+	*count = counts[0] + counts[1];
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void keypool_retain(void) {
+	pthread_once(&atfork_once, register_atfork);
+	pthread_mutex_lock(&pool_lock);
+	pool_refs++;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void keypool_release(void) {
+	// the thread must be stopped before the library is unloaded
+	pthread_mutex_lock(&pool_lock);
+	if (--pool_refs == 0) {
+		stop_thread();
+		free_pools();
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+#endif  // win32 or unix?
@@ -8,9 +8,6 @@ luanacha
 This is a Lua library wrapping the Monocypher library by Loup Vaillant.
 http://loup-vaillant.fr/projects/monocypher/
 
-TODO   add the AEAD functions to the binding
-       (and/or replace the current "(un)lock-with-prefix" functions)
-       
 181211 adjusted to monocypher-2.0.5
 170807 adjusted to monocypher-1.0.1
 
@@ -18,7 +15,8 @@ TODO   add the AEAD functions to the binding
 luanachaAPI:
 
 randombytes(n)
-	return a string containing n random bytes
+	return a string containing n random bytes (any n >= 0)
+	
 	
 --- Authenticated encryption
 
@@ -32,6 +30,43 @@ unlock
 	authenticated decryption
 	with an optional offset for the start of the encrypted text
 
+lock_aead, unlock_aead
+	authenticated encryption with additional data (AEAD)
+	(same prefix and offset as lock and unlock)
+
+lock_into, unlock_into
+	encryption and decryption in place inside a buffer
+
+lock_many, unlock_many
+	encryption and decryption of lists of messages with one key
+
+nonce_sequence, lock_auto
+	unique nonces from a random prefix and a counter, and encryption
+	with the next nonce of a sequence (prepended to the encrypted text)
+
+encryptor, decryptor
+	encrypted streams: a sequence of chunks encrypted with one key
+	(per-chunk MAC, final chunk tag, rekeying)
+
+lock_parallel, unlock_parallel
+	authenticated encryption of large texts, in chunks encrypted 
+	by the worker threads
+
+seekfile_write, seekfile
+	encrypted files with random access: a range of the text can be
+	authenticated and decrypted without reading the whole file
+
+--- Byte buffers and key handles
+
+buffer
+	a mutable byte buffer. Buffers are accepted instead of strings 
+	as input by all the functions
+
+key
+	an opaque secret key, kept out of the Lua heap in a locked memory
+	arena and wiped when collected. Keys are accepted instead of 
+	strings as input by all the functions
+
 --- Curve25519-based key exchange
 
 x25519_keypair
@@ -43,6 +78,14 @@ x25519_public_key
 lock_key
 	DH key exchange. Return a session key
 
+key_cache
+	create a bounded LRU cache of session keys
+	(kc:key_exchange(), kc:invalidate(), kc:stats())
+
+keypair_pool
+	enable pools of precomputed key pairs, refilled by a background 
+	thread (used by x25519_keypair() and sign_keypair())
+
 --- Blake2b cryptographic hash
 
 blake2b_init
@@ -60,6 +103,18 @@ blake2b
 argon2i
 	a blake2b-based Key Derivation Function
 
+--- Asynchronous jobs
+
+async
+	call a library function in a native worker thread, and return
+	a future (f:done(), f:result())
+
+async_fd, async_ack
+	a file descriptor signaling the completed jobs, for event loops
+
+async_threads
+	set the number of async worker threads
+
 
 --- Ed25519 signature
 
@@ -72,9 +127,58 @@ sign_public_key
 sign
 	sign a text with a secret key
 
+signer
+	create a signer object for a secret key (s:sign(), s:public_key())
+	- the secret key is expanded only once
+
 check
 	check a text signature with a public key
 
+check_batch
+	check a list of text signatures (batch verification)
+
+verifier
+	create a verifier object for a public key (v:check(), 
+	v:public_key()) - the public key is decompressed only once
+
+verifier_cache
+	return stats about the cache of recently created verifiers 
+	(optionally resize it)
+
+check_cache
+	create a cache of successful signature checks 
+	(cc:check(), cc:stats(), cc:clear())
+
+keystore_build
+	create or update a file with decompressed public keys (key store)
+
+keystore
+	open a key store (ks:verifier(), ks:count()) - the verifiers
+	created from the store use the keys loaded with the store
+
+sign_many
+	sign a list of texts with a signer, using the worker threads
+
+check_many
+	check a list of text signatures, using the worker threads
+
+sign_file
+	sign the content of a file with a signer (the file is read by chunks)
+
+check_file
+	check the signature of the content of a file
+
+sign_ph, check_ph
+	prehashed signature (the text is hashed once with blake2b, then
+	the digest is signed with a domain separator)
+
+sign_ph_init, check_ph_init
+	create a context to sign / check a stream with a prehashed 
+	signature (ctx:update(), ctx:final())
+
+workpool
+	get or set the number of worker threads and the work split grain
+
 ---
 
 Links:
@@ -87,6 +191,11 @@ https://en.wikipedia.org/wiki/BLAKE_%28hash_function%29
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 #include "lua.h"
 #include "lauxlib.h"
@@ -113,6 +222,27 @@ https://en.wikipedia.org/wiki/BLAKE_%28hash_function%29
 #define luaL_register(L,n,f) \
 	{ if ((n) == NULL) luaL_setfuncs(L,f,0); else luaL_newlib(L,f); }
 
+#else
+
+// Lua 5.1 has no luaL_buffinitsize(): large results are built in a 
+// userdata, and copied into a string by luaL_pushresultsize(). 
+// (sz must be the same in both calls)
+static char *luaL_buffinitsize(lua_State *L, luaL_Buffer *B, size_t sz) {
+	luaL_buffinit(L, B);
+	if (sz <= LUAL_BUFFERSIZE) return luaL_prepbuffer(B);
+	return lua_newuserdata(L, sz);
+}
+
+static void luaL_pushresultsize(luaL_Buffer *B, size_t sz) {
+	if (sz <= LUAL_BUFFERSIZE) {
+		luaL_addsize(B, sz);
+		luaL_pushresult(B);
+	} else {
+		lua_pushlstring(B->L, lua_touserdata(B->L, -1), sz);
+		lua_remove(B->L, -2);
+	}
+}
+
 #endif
 
 //----------------------------------------------------------------------
@@ -123,30 +253,300 @@ https://en.wikipedia.org/wiki/BLAKE_%28hash_function%29
 
 
 extern int randombytes(unsigned char *x,unsigned long long xlen); 
+extern void randombytes_retain(void);
+extern void randombytes_release(void);
 
 static int ln_randombytes(lua_State *L) {
 	// Lua API:   randombytes(n)  returns a string with n random bytes 
-	// n must be 256 or less.
-	// randombytes return nil, error msg  if the RNG fails or if n > 256
+	// randombytes return nil, error msg  if the RNG fails or if n < 0
+	// (the bytes are produced by a per-thread ChaCha20 generator
+	// seeded by the OS - see randombytes.c)
 	//	
-    size_t bufln; 
-	unsigned char buf[256];
 	lua_Integer li = luaL_checkinteger(L, 1);  // 1st arg
-	if ((li > 256 ) || (li < 0)) {
+	if (li < 0) {
 		lua_pushnil (L);
 		lua_pushliteral(L, "invalid byte number");
 		return 2;      		
 	}
-	int r = randombytes(buf, li);
+	size_t n = (size_t) li;
+	// the bytes are often used as a key: they are not built in a Lua 
+	// buffer (its box is freed without being wiped), but in a local 
+	// array or a userdata which is wiped once the string is created
+	unsigned char sbuf[256];
+	unsigned char *buf = (n <= sizeof(sbuf)) ? sbuf : 
+		(unsigned char*) lua_newuserdata(L, n);
+	int r = randombytes(buf, n);
 	if (r != 0) { 
+		crypto_wipe(buf, n);
 		lua_pushnil (L);
 		lua_pushliteral(L, "random generator error");
 		return 2;         
 	} 	
-    lua_pushlstring (L, buf, li); 
+	lua_pushlstring (L, (char*)buf, n); 
+	crypto_wipe(buf, n);
 	return 1;
 }//randombytes()
 
+//----------------------------------------------------------------------
+// mutable byte buffers
+
+// A buffer is a fixed-size userdata which can be used instead of a 
+// string for any input of the library functions. lock_into() and 
+// unlock_into() encrypt and decrypt in place inside a buffer, so 
+// that an application can reuse one buffer for all its messages.
+//
+// Positions in sub() and set() are 1-based, as in the string library.
+// Offsets in lock_into() and unlock_into() are 0-based (the number of
+// bytes before the encrypted text), as the offset in unlock().
+
+#define BUFFER_MT "luanacha.buffer"
+
+typedef struct {
+	size_t len;
+	unsigned char data[];
+} buffer;
+
+// secret key handles (see below) are also accepted as input
+#define KEY_MT "luanacha.key"
+
+typedef struct {
+	unsigned char *k;	// 32-byte slot in the key arena, or NULL
+} keyhandle;
+
+static void *toudata(lua_State *L, int i, const char *mt) {
+	// return the userdata at index i, or NULL if its metatable is 
+	// not mt
+	void *u = lua_touserdata(L, i);
+	if ((u == NULL) || !lua_getmetatable(L, i)) return NULL;
+	luaL_getmetatable(L, mt);
+	if (!lua_rawequal(L, -1, -2)) u = NULL;
+	lua_pop(L, 2);
+	return u;
+}
+
+static const char *tobytes(lua_State *L, int i, size_t *ln) {
+	// return the content of a string, a buffer or a key handle at 
+	// index i, or NULL (numbers are converted to strings, as with 
+	// lua_tolstring())
+	if (lua_type(L, i) == LUA_TUSERDATA) {
+		buffer *b = toudata(L, i, BUFFER_MT);
+		if (b != NULL) {
+			if (ln != NULL) *ln = b->len;
+			return (const char *) b->data;
+		}
+		keyhandle *kh = toudata(L, i, KEY_MT);
+		if ((kh == NULL) || (kh->k == NULL)) return NULL;
+		if (ln != NULL) *ln = 32;
+		return (const char *) kh->k;
+	}
+	return lua_tolstring(L, i, ln);
+}
+
+static const char *checkbytes(lua_State *L, int i, size_t *ln) {
+	// same as luaL_checklstring(), but also accept a buffer or a key
+	const char *s = tobytes(L, i, ln);
+	if (s == NULL) luaL_argerror(L, i, "string, buffer or key expected");
+	return s;
+}
+
+static const char *optbytes(lua_State *L, int i, const char *d, 
+		size_t *ln) {
+	// same as luaL_optlstring(), but also accept a buffer or a key
+	if (lua_isnoneornil(L, i)) {
+		if (ln != NULL) *ln = (d == NULL) ? 0 : strlen(d);
+		return d;
+	}
+	return checkbytes(L, i, ln);
+}
+
+static const char *checkitem(lua_State *L, int i, size_t *ln) {
+	// same as checkbytes(), for a list item which is popped before its
+	// content is used: only a string, a buffer or a key is accepted (a
+	// number would be converted to a string referenced by nothing)
+	int t = lua_type(L, i);
+	if ((t != LUA_TSTRING) && (t != LUA_TUSERDATA)) 
+		luaL_error(L, "string, buffer or key expected in list");
+	return checkbytes(L, i, ln);
+}
+
+static buffer *checkbuffer(lua_State *L, int i) {
+	return luaL_checkudata(L, i, BUFFER_MT);
+}
+
+static void check_bounds(lua_State *L, buffer *b, lua_Integer i, 
+		lua_Integer ln) {
+	// raise an error if [i, i+ln) (0-based) is not inside b
+	if ((i < 0) || (ln < 0) || ((size_t) i > b->len) 
+		|| ((size_t) ln > b->len - (size_t) i)) {
+		luaL_error(L, "out of buffer bounds");
+	}
+}
+
+static int ln_buffer(lua_State *L) {
+	// Lua API: buffer(n) or buffer(s) => b
+	// n: size of the buffer in bytes. The buffer is filled with zeros
+	// s: a string or a buffer. The new buffer is a copy of s
+	// return b, a buffer object
+	size_t ln;
+	const char *s = NULL;
+	if (lua_type(L, 1) == LUA_TNUMBER) {
+		lua_Integer n = luaL_checkinteger(L, 1);
+		if (n < 0) LERR("bad buffer size");
+		ln = (size_t) n;
+	} else {
+		s = checkbytes(L, 1, &ln);
+	}
+	buffer *b = lua_newuserdata(L, sizeof(buffer) + ln);
+	b->len = ln;
+	if (s != NULL) memcpy(b->data, s, ln);
+	else memset(b->data, 0, ln);
+	luaL_getmetatable(L, BUFFER_MT);
+	lua_setmetatable(L, -2);
+	return 1;
+}// ln_buffer()
+
+static int ln_buffer_len(lua_State *L) {
+	// Lua API: #b => number of bytes in b
+	buffer *b = checkbuffer(L, 1);
+	lua_pushinteger(L, b->len);
+	return 1;
+}
+
+static int ln_buffer_tostring(lua_State *L) {
+	// Lua API: tostring(b) => a string with the content of b
+	buffer *b = checkbuffer(L, 1);
+	lua_pushlstring(L, (const char *) b->data, b->len);
+	return 1;
+}
+
+static int ln_buffer_sub(lua_State *L) {
+	// Lua API: b:sub(i [, j]) => string
+	// same as string.sub(tostring(b), i, j), without the copy of b
+	buffer *b = checkbuffer(L, 1);
+	lua_Integer len = b->len;
+	lua_Integer i = luaL_checkinteger(L, 2);
+	lua_Integer j = luaL_optinteger(L, 3, -1);
+	if (i < 0) i = (i < -len) ? 1 : len + i + 1; // (-i may overflow)
+	if (j < 0) j = len + j + 1;
+	if (i < 1) i = 1;
+	if (j > len) j = len;
+	if (i > j) lua_pushliteral(L, "");
+	else lua_pushlstring(L, (const char *) b->data + i - 1, j - i + 1);
+	return 1;
+}// ln_buffer_sub()
+
+static int ln_buffer_set(lua_State *L) {
+	// Lua API: b:set(i, s) => b
+	// copy s (a string or a buffer) in b at position i (1-based)
+	// raise an error if s does not fit in b
+	size_t sln;
+	buffer *b = checkbuffer(L, 1);
+	lua_Integer i = luaL_checkinteger(L, 2);
+	const char *s = checkbytes(L, 3, &sln);
+	check_bounds(L, b, i - 1, sln);
+	memmove(b->data + i - 1, s, sln); // s may be b
+	lua_settop(L, 1);
+	return 1;
+}// ln_buffer_set()
+
+static int ln_buffer_wipe(lua_State *L) {
+	// Lua API: b:wipe() => b
+	// overwrite the content of b with zeros
+	buffer *b = checkbuffer(L, 1);
+	crypto_wipe(b->data, b->len);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static const struct luaL_Reg buffer_methods[] = {
+	{"sub", ln_buffer_sub},
+	{"set", ln_buffer_set},
+	{"wipe", ln_buffer_wipe},
+	{"__len", ln_buffer_len},
+	{"__tostring", ln_buffer_tostring},
+	{NULL, NULL},
+};
+
+//----------------------------------------------------------------------
+// secret key handles
+//
+// A key handle is an opaque userdata which holds a 32-byte secret 
+// key in the key arena (see keyarena.c): the key is not a Lua string,
+// so it is never interned or copied by Lua, it is locked in RAM, and
+// it is wiped when the handle is collected (or by k:wipe()). Handles
+// are accepted instead of strings by all the functions (see tobytes).
+
+extern unsigned char *keyarena_alloc(void);
+extern void keyarena_free(unsigned char *slot);
+extern void keyarena_stats(int *count, int *locked);
+
+static unsigned char *new_key(lua_State *L) {
+	// push a new key handle, and return its 32-byte slot
+	keyhandle *kh = lua_newuserdata(L, sizeof(keyhandle));
+	kh->k = NULL;
+	luaL_getmetatable(L, KEY_MT);
+	lua_setmetatable(L, -2);
+	kh->k = keyarena_alloc();
+	if (kh->k == NULL) luaL_error(L, "cannot allocate a key");
+	return kh->k;
+}
+
+static int ln_key(lua_State *L) {
+	// Lua API: key([s]) => k
+	//  s: optional 32-byte string, buffer or key. If not provided, 
+	//     a random key is generated
+	//  return k, a new key handle (a copy of s)
+	size_t sln;
+	const char *s = optbytes(L, 1, NULL, &sln);
+	if ((s != NULL) && (sln != 32)) LERR("bad key size");
+	unsigned char *k = new_key(L);
+	if (s != NULL) memcpy(k, s, 32);
+	else if (randombytes(k, 32) != 0) LERR("random generator error");
+	return 1;
+} // ln_key()
+
+static keyhandle *checkkey(lua_State *L, int i) {
+	keyhandle *kh = luaL_checkudata(L, i, KEY_MT);
+	if (kh->k == NULL) luaL_error(L, "key has been wiped");
+	return kh;
+}
+
+static int ln_key_export(lua_State *L) {
+	// Lua API: k:export() => s
+	//  return the key as a 32-byte string (the string cannot be wiped)
+	keyhandle *kh = checkkey(L, 1);
+	lua_pushlstring(L, (const char *) kh->k, 32);
+	return 1;
+}
+
+static int ln_key_wipe(lua_State *L) {
+	// Lua API: k:wipe()
+	//  wipe the key and release its slot. The handle cannot be used
+	//  again. (also done when the handle is collected)
+	keyhandle *kh = luaL_checkudata(L, 1, KEY_MT);
+	keyarena_free(kh->k);
+	kh->k = NULL;
+	return 0;
+}
+
+static int ln_key_arena(lua_State *L) {
+	// Lua API: key_arena() => count, locked
+	//  count: number of keys in the arena
+	//  locked: true if the arena is locked in RAM
+	int count, locked;
+	keyarena_stats(&count, &locked);
+	lua_pushinteger(L, count);
+	lua_pushboolean(L, locked);
+	return 2;
+}
+
+static const struct luaL_Reg key_methods[] = {
+	{"export", ln_key_export},
+	{"wipe", ln_key_wipe},
+	{"__gc", ln_key_wipe},
+	{NULL, NULL},
+};
+
 //----------------------------------------------------------------------
 // authenticated encryption
 
@@ -158,25 +558,25 @@ static int ln_lock(lua_State *L) {
 	//  pfx: optional prefix string - prepended to the encrypted text
 	//     - pfx length should be a multiple of 8 for alignment
 	//  return encrypted text string
-	int r;
 	size_t mln, nln, kln, pfxln, bufln;
-	const char *k = luaL_checklstring(L,1,&kln);
-	const char *n = luaL_checklstring(L,2,&nln);	
-	const char *m = luaL_checklstring(L,3,&mln);	
-	const char *pfx = luaL_optlstring(L,4,"",&pfxln);
+	const char *k = checkbytes(L,1,&kln);
+	const char *n = checkbytes(L,2,&nln);	
+	const char *m = checkbytes(L,3,&mln);	
+	const char *pfx = optbytes(L,4,"",&pfxln);
 	if (nln != 24) LERR("bad nonce size");
 	if (kln != 32) LERR("bad key size");
 	if ((pfxln % 8) != 0) LERR("bad prefix size");
 	bufln = mln + 16 + pfxln;
-	unsigned char * buf = malloc(bufln);
+	// the result is built in place in a Lua buffer
+	luaL_Buffer b;
+	unsigned char *buf = (unsigned char*) luaL_buffinitsize(L, &b, bufln);
 	// monocypher-1.0: pass separately mac and encr.text
 	// mac is prepended to the encr text buffer
 	crypto_lock(buf+pfxln, buf+pfxln+16, k, n, m, mln);
 	if (pfxln > 0) {
 		memcpy(buf, pfx, pfxln);
 	}
-	lua_pushlstring (L, buf, bufln); 
-	free(buf);
+	luaL_pushresultsize(&b, bufln); 
 	return 1;
 } // lock()
 
@@ -190,44 +590,706 @@ static int ln_unlock(lua_State *L) {
 	//  return plain text string or (nil, error msg if MAC is not valid)
 	int r = 0;
 	size_t cln, nln, kln, boxln;
-	const char *k = luaL_checklstring(L,1,&kln);
-	const char *n = luaL_checklstring(L,2,&nln);	
-	const char *c = luaL_checklstring(L,3,&cln);	
+	const char *k = checkbytes(L,1,&kln);
+	const char *n = checkbytes(L,2,&nln);	
+	const char *c = checkbytes(L,3,&cln);	
 	int i = luaL_optinteger(L,4, 0);	
 	if (nln != 24) LERR("bad nonce size");
 	if (kln != 32) LERR("bad key size");
-	
-	unsigned char * buf = malloc(cln);
+	if ((i < 0) || (cln < 16) || ((size_t)i > cln - 16)) {
+		// no room for the mac
+		lua_pushnil (L);
+		lua_pushliteral(L, "unlock error");
+		return 2;         
+	}
 	boxln = cln - i;
+	// the plain text is decrypted in place in a Lua buffer
+	luaL_Buffer b;
+	unsigned char *buf = (unsigned char*) luaL_buffinitsize(L, &b, boxln-16);
 	// mac and encr text passed as two vars
 	// mac is at c+i, encr text is at c+i+16
 	r = crypto_unlock(buf, k, n, c+i, c+i+16, boxln-16);
 	if (r != 0) { 
-		free(buf); 
 		lua_pushnil (L);
 		lua_pushliteral(L, "unlock error");
 		return 2;         
 	} 
-	lua_pushlstring (L, buf, boxln-16); 
-	free(buf);
+	luaL_pushresultsize(&b, boxln-16); 
 	return 1;
 } // ln_unlock()
 
+static int ln_lock_aead(lua_State *L) {
+	// Lua API: lock_aead(k, n, m, ad [, pfx])
+	//  k: key string (32 bytes)
+	//  n: nonce string (24 bytes)
+	//	m: message (plain text) string 
+	//  ad: additional data string - authenticated, not encrypted,
+	//     and not included in the result
+	//  pfx: optional prefix string - prepended to the encrypted text
+	//     - pfx length should be a multiple of 8 for alignment
+	//  return encrypted text string
+	size_t mln, nln, kln, adln, pfxln, bufln;
+	const char *k = checkbytes(L,1,&kln);
+	const char *n = checkbytes(L,2,&nln);	
+	const char *m = checkbytes(L,3,&mln);	
+	const char *ad = checkbytes(L,4,&adln);	
+	const char *pfx = optbytes(L,5,"",&pfxln);
+	if (nln != 24) LERR("bad nonce size");
+	if (kln != 32) LERR("bad key size");
+	if ((pfxln % 8) != 0) LERR("bad prefix size");
+	bufln = mln + 16 + pfxln;
+	// the result is built in place in a Lua buffer
+	luaL_Buffer b;
+	unsigned char *buf = (unsigned char*) luaL_buffinitsize(L, &b, bufln);
+	crypto_lock_aead(buf+pfxln, buf+pfxln+16, k, n, ad, adln, m, mln);
+	if (pfxln > 0) {
+		memcpy(buf, pfx, pfxln);
+	}
+	luaL_pushresultsize(&b, bufln); 
+	return 1;
+} // ln_lock_aead()
+
+static int ln_unlock_aead(lua_State *L) {
+	// Lua API: unlock_aead(k, n, c, ad [, i])
+	//  k: key string (32 bytes)
+	//  n: nonce string (24 bytes)
+	//	c: encrypted message string 
+	//  ad: additional data string (the same as for lock_aead())
+	//  i: optional offset of the start of the encrypted text in c
+	//     default value is 0 - useful if c starts with a prefix
+	//  return plain text string or (nil, error msg if MAC is not valid)
+	size_t cln, nln, kln, adln, boxln;
+	const char *k = checkbytes(L,1,&kln);
+	const char *n = checkbytes(L,2,&nln);	
+	const char *c = checkbytes(L,3,&cln);	
+	const char *ad = checkbytes(L,4,&adln);	
+	lua_Integer i = luaL_optinteger(L,5, 0);	
+	if (nln != 24) LERR("bad nonce size");
+	if (kln != 32) LERR("bad key size");
+	if ((i < 0) || (cln < 16) || ((size_t)i > cln - 16)) {
+		// no room for the mac
+		lua_pushnil (L);
+		lua_pushliteral(L, "unlock error");
+		return 2;         
+	}
+	boxln = cln - i;
+	luaL_Buffer b;
+	unsigned char *buf = (unsigned char*) luaL_buffinitsize(L, &b, boxln-16);
+	if (crypto_unlock_aead(buf, k, n, c+i, ad, adln, c+i+16, boxln-16) != 0) {
+		lua_pushnil (L);
+		lua_pushliteral(L, "unlock error");
+		return 2;         
+	} 
+	luaL_pushresultsize(&b, boxln-16); 
+	return 1;
+} // ln_unlock_aead()
+
+static int ln_lock_into(lua_State *L) {
+	// Lua API: lock_into(k, n, b, i, mln) => j
+	//  k: key string (32 bytes)
+	//  n: nonce string (24 bytes)
+	//  b: a buffer. The mln bytes of plain text at offset i+16 in b
+	//     are encrypted in place, and the MAC is written at offset i
+	//     (the same layout as the result of lock())
+	//  i: offset of the MAC in b (0-based)
+	//  return j, the offset of the first byte after the encrypted text
+	//  (i + 16 + mln)
+	size_t nln, kln;
+	const char *k = checkbytes(L,1,&kln);
+	const char *n = checkbytes(L,2,&nln);	
+	buffer *b = checkbuffer(L, 3);
+	lua_Integer i = luaL_checkinteger(L, 4);
+	lua_Integer mln = luaL_checkinteger(L, 5);
+	if (nln != 24) LERR("bad nonce size");
+	if (kln != 32) LERR("bad key size");
+	if ((mln < 0) || (mln > (lua_Integer) b->len)) {
+		LERR("out of buffer bounds");
+	}
+	check_bounds(L, b, i, mln + 16);
+	unsigned char *mac = b->data + i;
+	crypto_lock(mac, mac + 16, k, n, mac + 16, mln);
+	lua_pushinteger(L, i + 16 + mln);
+	return 1;
+} // ln_lock_into()
+
+static int ln_unlock_into(lua_State *L) {
+	// Lua API: unlock_into(k, n, b, i, cln) => mln
+	//  k: key string (32 bytes)
+	//  n: nonce string (24 bytes)
+	//  b: a buffer. The cln bytes at offset i in b (MAC and encrypted
+	//     text, as produced by lock() or lock_into()) are decrypted 
+	//     in place: the plain text is at offset i+16 in b
+	//  i: offset of the MAC in b (0-based)
+	//  return mln, the length of the plain text (cln - 16), or 
+	//  (nil, error msg) if the MAC is not valid. b is then unchanged
+	size_t nln, kln;
+	const char *k = checkbytes(L,1,&kln);
+	const char *n = checkbytes(L,2,&nln);	
+	buffer *b = checkbuffer(L, 3);
+	lua_Integer i = luaL_checkinteger(L, 4);
+	lua_Integer cln = luaL_checkinteger(L, 5);
+	if (nln != 24) LERR("bad nonce size");
+	if (kln != 32) LERR("bad key size");
+	check_bounds(L, b, i, cln);
+	if (cln < 16) {
+		lua_pushnil (L);
+		lua_pushliteral(L, "unlock error");
+		return 2;         
+	}
+	unsigned char *mac = b->data + i;
+	if (crypto_unlock(mac + 16, k, n, mac, mac + 16, cln - 16) != 0) { 
+		lua_pushnil (L);
+		lua_pushliteral(L, "unlock error");
+		return 2;         
+	} 
+	lua_pushinteger(L, cln - 16);
+	return 1;
+} // ln_unlock_into()
+
+// lock_many() and unlock_many() process lists of messages with one 
+// key in a single call. The HChacha20 subkey (see crypto_lock_init())
+// is derived again only when the first 16 bytes of the nonce change:
+// with nonces made of a fixed prefix and a counter, it is derived
+// once for the whole list.
+
+typedef struct {
+	unsigned char prefix[16];	// nonce prefix of the subkey
+	unsigned char subkey[32];
+	int valid;
+} subkey_cache;
+
+static const unsigned char *get_subkey(subkey_cache *sc, const char *k,
+		const char *n) {
+	if (!sc->valid || (memcmp(sc->prefix, n, 16) != 0)) {
+		crypto_chacha20_H(sc->subkey, k, n);
+		memcpy(sc->prefix, n, 16);
+		sc->valid = 1;
+	}
+	return sc->subkey;
+}
+
+static const char *check_many_item(lua_State *L, int i, size_t *ln,
+		const char **n) {
+	// get the nonce and the text of item i of lists at index 2 and 3
+	// (pushed on the stack)
+	size_t nln;
+	lua_rawgeti(L, 2, i);
+	lua_rawgeti(L, 3, i);
+	*n = checkbytes(L, -2, &nln);
+	if (nln != 24) luaL_error(L, "bad nonce size");
+	return checkbytes(L, -1, ln);
+}
+
+static int ln_lock_many(lua_State *L) {
+	// Lua API: lock_many(k, ns, ms) => cs
+	//  k: key string (32 bytes)
+	//  ns: list of nonces (24-byte strings)
+	//  ms: list of messages (strings), as many as nonces
+	//  return cs, the list of encrypted texts: cs[i] is the same as
+	//  lock(k, ns[i], ms[i])
+	size_t kln, mln;
+	const char *n;
+	subkey_cache sc;
+	crypto_lock_ctx ctx;
+	const char *k = checkbytes(L,1,&kln);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	if (kln != 32) LERR("bad key size");
+	int nb = lua_objlen(L, 3);
+	if (lua_objlen(L, 2) != nb) LERR("nonce and message lists differ");
+	sc.valid = 0;
+	lua_createtable(L, nb, 0);
+	for (int i = 1; i <= nb; i++) {
+		const char *m = check_many_item(L, i, &mln, &n);
+		luaL_Buffer b;
+		unsigned char *c = (unsigned char*) luaL_buffinitsize(L, &b, mln + 16);
+		crypto_lock_init_derived(&ctx, get_subkey(&sc, k, n), n + 16);
+		crypto_lock_update(&ctx, c + 16, m, mln);
+		crypto_lock_final(&ctx, c);
+		luaL_pushresultsize(&b, mln + 16);
+		lua_rawseti(L, -4, i);
+		lua_pop(L, 2);
+	}
+	crypto_wipe(&sc, sizeof(sc));
+	return 1;
+} // ln_lock_many()
+
+static int ln_unlock_many(lua_State *L) {
+	// Lua API: unlock_many(k, ns, cs) => ms, nerr
+	//  k: key string (32 bytes)
+	//  ns: list of nonces (24-byte strings)
+	//  cs: list of encrypted texts, as many as nonces
+	//  return ms, the list of decrypted texts (ms[i] is false if 
+	//  cs[i] is not valid), and nerr, the number of invalid texts
+	size_t kln, cln;
+	const char *n;
+	subkey_cache sc;
+	crypto_unlock_ctx ctx;
+	int nerr = 0;
+	const char *k = checkbytes(L,1,&kln);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	if (kln != 32) LERR("bad key size");
+	int nb = lua_objlen(L, 3);
+	if (lua_objlen(L, 2) != nb) LERR("nonce and text lists differ");
+	sc.valid = 0;
+	lua_createtable(L, nb, 0);
+	for (int i = 1; i <= nb; i++) {
+		const char *c = check_many_item(L, i, &cln, &n);
+		if (cln < 16) {
+			lua_pushboolean(L, 0);
+			nerr++;
+		} else {
+			// the mac is checked first: the Lua buffer is only 
+			// used for a valid text, which is decrypted in place
+			crypto_unlock_init_derived(&ctx, get_subkey(&sc, k, n), n + 16);
+			crypto_unlock_auth_message(&ctx, c + 16, cln - 16);
+			crypto_chacha_ctx chacha = ctx.chacha; // wiped by final()
+			if (crypto_unlock_final(&ctx, c) == 0) {
+				luaL_Buffer b;
+				unsigned char *m = (unsigned char*) 
+					luaL_buffinitsize(L, &b, cln - 16);
+				crypto_chacha20_encrypt(&chacha, m, c + 16, cln - 16);
+				luaL_pushresultsize(&b, cln - 16);
+			} else {
+				lua_pushboolean(L, 0);
+				nerr++;
+			}
+			crypto_wipe(&chacha, sizeof(chacha));
+		}
+		lua_rawseti(L, -4, i);
+		lua_pop(L, 2);
+	}
+	crypto_wipe(&sc, sizeof(sc));
+	lua_pushinteger(L, nerr);
+	return 2;
+} // ln_unlock_many()
+
+//----------------------------------------------------------------------
+// nonce sequences
+//
+// A nonce sequence produces unique 24-byte nonces without a call to 
+// the random generator for each message: nonce i is the random 
+// 16-byte prefix of the sequence followed by i (8 bytes, little 
+// endian). The counter is incremented atomically, so a sequence 
+// shared by several threads never produces the same nonce twice.
+// (A sequence must not be used by both processes after a fork())
+// A sequence can be resumed with a given prefix, but the caller must
+// then provide the counter value where it stopped (seq:counter()).
+
+#define NONCE_SEQ_MT "luanacha.nonce_sequence"
+
+typedef struct {
+	unsigned char prefix[16];
+	uint64_t counter;	// next value
+} nonce_seq;
+
+// atomic load and compare-and-swap of the counters
+#if defined(__GNUC__)
+#define counter_load(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define counter_cas(p, old, new) __atomic_compare_exchange_n((p), \
+	(old), (new), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+static uint64_t counter_load(uint64_t *p) {
+	return (uint64_t) _InterlockedCompareExchange64(
+		(volatile __int64 *) p, 0, 0);
+}
+static int counter_cas(uint64_t *p, uint64_t *old, uint64_t new) {
+	uint64_t c = (uint64_t) _InterlockedCompareExchange64(
+		(volatile __int64 *) p, (__int64) new, (__int64) *old);
+	if (c == *old) return 1;
+	*old = c;
+	return 0;
+}
+#elif !defined(_WIN32)
+static pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t counter_load(uint64_t *p) {
+	pthread_mutex_lock(&counter_mutex);
+	uint64_t c = *p;
+	pthread_mutex_unlock(&counter_mutex);
+	return c;
+}
+static int counter_cas(uint64_t *p, uint64_t *old, uint64_t new) {
+	pthread_mutex_lock(&counter_mutex);
+	int r = (*p == *old);
+	if (r) *p = new;
+	else *old = *p;
+	pthread_mutex_unlock(&counter_mutex);
+	return r;
+}
+#else
+#error "no atomic operations for the nonce sequences"
+#endif
+
+static int next_nonce(nonce_seq *seq, unsigned char n[24]) {
+	// write the next nonce of the sequence. return 0, or -1 if the
+	// sequence is exhausted
+	uint64_t c = counter_load(&seq->counter);
+	do {
+		if (c == UINT64_MAX) return -1;
+	} while (!counter_cas(&seq->counter, &c, c + 1));
+	memcpy(n, seq->prefix, 16);
+	for (int i = 0; i < 8; i++) n[16 + i] = (unsigned char) (c >> (8 * i));
+	return 0;
+}
+
+static int ln_nonce_sequence(lua_State *L) {
+	// Lua API: nonce_sequence([prefix, start]) => seq
+	//  prefix: optional 16-byte string. Default is a random prefix.
+	//  start: first counter value, required with a prefix: a 
+	//     sequence resumed with the same prefix and a lower counter 
+	//     would reuse nonces
+	//  return seq, a nonce sequence (seq:next(), seq:prefix(),
+	//  seq:counter())
+	size_t pfxln;
+	lua_Integer start = 0;
+	const char *pfx = optbytes(L, 1, NULL, &pfxln);
+	if (pfx != NULL) {
+		if (pfxln != 16) LERR("bad prefix size");
+		if (lua_isnoneornil(L, 2)) LERR("a start counter is required");
+		start = luaL_checkinteger(L, 2);
+		if (start < 0) LERR("bad start counter");
+	}
+	nonce_seq *seq = lua_newuserdata(L, sizeof(nonce_seq));
+	seq->counter = (uint64_t) start;
+	if (pfx != NULL) memcpy(seq->prefix, pfx, 16);
+	else if (randombytes(seq->prefix, 16) != 0) {
+		LERR("random generator error");
+	}
+	luaL_getmetatable(L, NONCE_SEQ_MT);
+	lua_setmetatable(L, -2);
+	return 1;
+} // ln_nonce_sequence()
+
+static int ln_nonce_next(lua_State *L) {
+	// Lua API: seq:next() => n
+	//  return the next nonce of the sequence (24 bytes)
+	unsigned char n[24];
+	nonce_seq *seq = luaL_checkudata(L, 1, NONCE_SEQ_MT);
+	if (next_nonce(seq, n) != 0) LERR("nonce sequence exhausted");
+	lua_pushlstring(L, (const char *) n, 24);
+	return 1;
+}
+
+static int ln_nonce_prefix(lua_State *L) {
+	// Lua API: seq:prefix() => prefix
+	//  return the 16-byte prefix of the sequence
+	nonce_seq *seq = luaL_checkudata(L, 1, NONCE_SEQ_MT);
+	lua_pushlstring(L, (const char *) seq->prefix, 16);
+	return 1;
+}
+
+static int ln_nonce_counter(lua_State *L) {
+	// Lua API: seq:counter() => i
+	//  return the counter of the next nonce (to resume the sequence
+	//  later with nonce_sequence(seq:prefix(), i)). Raise an error if
+	//  the counter is larger than the largest Lua integer
+	nonce_seq *seq = luaL_checkudata(L, 1, NONCE_SEQ_MT);
+	uint64_t c = counter_load(&seq->counter);
+	uint64_t max = ((uint64_t) 1 << (8 * sizeof(lua_Integer) - 1)) - 1;
+	if (c > max) LERR("counter out of range");
+	lua_pushinteger(L, (lua_Integer) c);
+	return 1;
+}
+
+static const struct luaL_Reg nonce_seq_methods[] = {
+	{"next", ln_nonce_next},
+	{"prefix", ln_nonce_prefix},
+	{"counter", ln_nonce_counter},
+	{NULL, NULL},
+};
+
+static int ln_lock_auto(lua_State *L) {
+	// Lua API: lock_auto(k, seq, m) => c
+	//  k: key string (32 bytes)
+	//  seq: a nonce sequence
+	//  m: message (plain text) string 
+	//  return the encrypted text, prefixed with the nonce taken from 
+	//  seq (same as lock(k, n, m, n)). It can be decrypted with 
+	//  unlock(k, c:sub(1, 24), c, 24)
+	size_t kln, mln;
+	const char *k = checkbytes(L,1,&kln);
+	nonce_seq *seq = luaL_checkudata(L, 2, NONCE_SEQ_MT);
+	const char *m = checkbytes(L,3,&mln);
+	if (kln != 32) LERR("bad key size");
+	size_t bufln = 24 + 16 + mln;
+	luaL_Buffer b;
+	unsigned char *buf = (unsigned char*) luaL_buffinitsize(L, &b, bufln);
+	if (next_nonce(seq, buf) != 0) {
+		luaL_pushresultsize(&b, bufln); // (for the 5.1 shim)
+		LERR("nonce sequence exhausted");
+	}
+	crypto_lock(buf+24, buf+40, k, buf, m, mln);
+	luaL_pushresultsize(&b, bufln); 
+	return 1;
+} // ln_lock_auto()
+
+//----------------------------------------------------------------------
+// encrypted streams
+//
+// A stream is a sequence of chunks encrypted with one key, in the
+// style of the libsodium secretstream API. The encryptor makes a
+// random 24-byte header, which must be sent before the chunks:
+//   stream key = HChacha20(k, header[0..16])
+//   chunk i nonce = header[16..24] .. i (8 bytes, little endian) .. 0*8
+// Each chunk is mac (16) .. encrypted tag (1) .. encrypted text, with
+// an optional additional data (AD). The tag tells whether the chunk
+// is the last one (final), whether the key must be replaced after 
+// it (rekey) or marks the end of a set of chunks for the application
+// (push). Chunks cannot be reordered, dropped or replayed, and the
+// decryptor knows when the stream has been truncated.
+
+#define ENCRYPTOR_MT "luanacha.encryptor"
+#define DECRYPTOR_MT "luanacha.decryptor"
+
+#define STREAM_MESSAGE 0
+#define STREAM_PUSH 1
+#define STREAM_REKEY 2
+#define STREAM_FINAL 3
+
+static const char *const stream_tags[] = {
+	"message", "push", "rekey", "final", NULL };
+
+typedef struct {
+	unsigned char key[32];  	// stream key
+	unsigned char inonce[8];	// header[16..24]
+	uint64_t counter;       	// index of the next chunk
+	int done;               	// the final chunk has been processed
+} stream;
+
+static stream *new_stream(lua_State *L, const char *mt, const char *k, 
+		const unsigned char header[24]) {
+	stream *st = lua_newuserdata(L, sizeof(stream));
+	crypto_chacha20_H(st->key, k, header);
+	memcpy(st->inonce, header + 16, 8);
+	st->counter = 0;
+	st->done = 0;
+	luaL_getmetatable(L, mt);
+	lua_setmetatable(L, -2);
+	return st;
+}
+
+static void stream_nonce(stream *st, unsigned char nonce[24]) {
+	memcpy(nonce, st->inonce, 8);
+	for (int i = 0; i < 8; i++) nonce[8 + i] = (st->counter >> (8*i)) & 0xff;
+	memset(nonce + 16, 0, 8);
+}
+
+static void stream_next(stream *st, int tag) {
+	// move to the next chunk after a chunk with this tag
+	static const unsigned char rekey[16] = "luanacha rekey";
+	st->counter++;
+	if (tag == STREAM_REKEY) {
+		// the new key is derived from the old one, which is erased.
+		// chunk nonces start again at 0 with the new key
+		crypto_chacha20_H(st->key, st->key, rekey);
+		st->counter = 0;
+	} else if (tag == STREAM_FINAL) {
+		crypto_wipe(st->key, 32);
+		st->done = 1;
+	}
+}
+
+static int ln_encryptor(lua_State *L) {
+	// Lua API: encryptor(k) => enc, header
+	//  k: key string (32 bytes)
+	//  return enc, an encryptor object, and header, a random 24-byte
+	//  string which must be passed to decryptor()
+	size_t kln;
+	unsigned char header[24];
+	const char *k = checkbytes(L,1,&kln);
+	if (kln != 32) LERR("bad key size");
+	if (randombytes(header, 24) != 0) LERR("random generator error");
+	new_stream(L, ENCRYPTOR_MT, k, header);
+	lua_pushlstring(L, (const char *) header, 24);
+	return 2;
+} // ln_encryptor()
+
+static int ln_encryptor_update(lua_State *L) {
+	// Lua API: enc:update(m [, tag [, ad]]) => c
+	//  m: the text of the chunk (string)
+	//  tag: "message" (default), "push", "rekey" or "final"
+	//  ad: optional additional data string (authenticated, not 
+	//     encrypted, not included in c)
+	//  return c, the encrypted chunk (#m + 17 bytes)
+	size_t mln, adln;
+	unsigned char nonce[24];
+	stream *st = luaL_checkudata(L, 1, ENCRYPTOR_MT);
+	const char *m = checkbytes(L,2,&mln);
+	unsigned char tag = luaL_checkoption(L, 3, "message", stream_tags);
+	const char *ad = optbytes(L,4,"",&adln);
+	if (st->done) LERR("stream already finalized");
+	luaL_Buffer b;
+	unsigned char *c = (unsigned char*) luaL_buffinitsize(L, &b, mln + 17);
+	crypto_lock_ctx ctx;
+	stream_nonce(st, nonce);
+	crypto_lock_init(&ctx, st->key, nonce);
+	crypto_lock_auth_ad(&ctx, ad, adln);
+	crypto_lock_update(&ctx, c + 16, &tag, 1);
+	crypto_lock_update(&ctx, c + 17, m, mln);
+	crypto_lock_final(&ctx, c);
+	stream_next(st, tag);
+	luaL_pushresultsize(&b, mln + 17);
+	return 1;
+} // ln_encryptor_update()
+
+static int ln_encryptor_final(lua_State *L) {
+	// Lua API: enc:final([m [, ad]]) => c
+	//  same as enc:update(m, "final", ad). m defaults to ""
+	lua_settop(L, 3);
+	if (lua_isnil(L, 2)) {
+		lua_pushliteral(L, "");
+		lua_replace(L, 2);
+	}
+	lua_pushliteral(L, "final");
+	lua_insert(L, 3);
+	return ln_encryptor_update(L);
+} // ln_encryptor_final()
+
+static int ln_decryptor(lua_State *L) {
+	// Lua API: decryptor(k, header) => dec
+	//  k: key string (32 bytes)
+	//  header: the 24-byte header returned by encryptor()
+	//  return dec, a decryptor object
+	size_t kln, hln;
+	const char *k = checkbytes(L,1,&kln);
+	const char *header = checkbytes(L,2,&hln);
+	if (kln != 32) LERR("bad key size");
+	if (hln != 24) LERR("bad header size");
+	new_stream(L, DECRYPTOR_MT, k, (const unsigned char *) header);
+	return 1;
+} // ln_decryptor()
+
+static int ln_decryptor_update(lua_State *L) {
+	// Lua API: dec:update(c [, ad]) => m, tag
+	//  c: an encrypted chunk, in the order of the encryptor
+	//  ad: additional data string (the same as for enc:update())
+	//  return the text of the chunk and its tag ("message", "push",
+	//  "rekey" or "final"), or (nil, error msg) if the chunk is not
+	//  valid. An invalid chunk does not change the decryptor state.
+	size_t cln, adln;
+	unsigned char nonce[24], tag = 0;
+	stream *st = luaL_checkudata(L, 1, DECRYPTOR_MT);
+	const char *c = checkbytes(L,2,&cln);
+	const char *ad = optbytes(L,3,"",&adln);
+	if (st->done) {
+		lua_pushnil (L);
+		lua_pushliteral(L, "stream already finalized");
+		return 2;         
+	}
+	if (cln < 17) {
+		lua_pushnil (L);
+		lua_pushliteral(L, "decryption error");
+		return 2;         
+	}
+	luaL_Buffer b;
+	unsigned char *m = (unsigned char*) luaL_buffinitsize(L, &b, cln - 17);
+	crypto_unlock_ctx ctx;
+	stream_nonce(st, nonce);
+	crypto_unlock_init(&ctx, st->key, nonce);
+	crypto_unlock_auth_ad(&ctx, ad, adln);
+	crypto_unlock_auth_message(&ctx, c + 16, cln - 16);
+	crypto_chacha_ctx chacha = ctx.chacha; // wiped by unlock_final()
+	int r = crypto_unlock_final(&ctx, c);
+	if (r == 0) {
+		// the mac is valid: decrypt
+		crypto_chacha20_encrypt(&chacha, &tag, c + 16, 1);
+		crypto_chacha20_encrypt(&chacha, m, c + 17, cln - 17);
+	}
+	crypto_wipe(&chacha, sizeof(chacha));
+	if ((r != 0) || (tag > STREAM_FINAL)) {
+		lua_pushnil (L);
+		lua_pushliteral(L, "decryption error");
+		return 2;         
+	}
+	stream_next(st, tag);
+	luaL_pushresultsize(&b, cln - 17);
+	lua_pushstring(L, stream_tags[tag]);
+	return 2;
+} // ln_decryptor_update()
+
+static int ln_stream_finished(lua_State *L) {
+	// Lua API: enc:finished() or dec:finished() => boolean
+	//  return true if the final chunk has been encrypted / decrypted.
+	//  At the end of the input, a decryptor which is not finished
+	//  means that the stream has been truncated.
+	int ok = 0;
+	if (lua_getmetatable(L, 1)) {
+		luaL_getmetatable(L, ENCRYPTOR_MT);
+		luaL_getmetatable(L, DECRYPTOR_MT);
+		ok = lua_rawequal(L, -1, -3) || lua_rawequal(L, -2, -3);
+		lua_pop(L, 3);
+	}
+	luaL_argcheck(L, ok, 1, "stream expected");
+	stream *st = lua_touserdata(L, 1);
+	lua_pushboolean(L, st->done);
+	return 1;
+}
+
+static int ln_stream_gc(lua_State *L) {
+	stream *st = lua_touserdata(L, 1);
+	crypto_wipe(st, sizeof(stream));
+	return 0;
+}
+
+static const struct luaL_Reg encryptor_methods[] = {
+	{"update", ln_encryptor_update},
+	{"final", ln_encryptor_final},
+	{"finished", ln_stream_finished},
+	{"__gc", ln_stream_gc},
+	{NULL, NULL},
+};
+
+static const struct luaL_Reg decryptor_methods[] = {
+	{"update", ln_decryptor_update},
+	{"finished", ln_stream_finished},
+	{"__gc", ln_stream_gc},
+	{NULL, NULL},
+};
+
 //----------------------------------------------------------------------
 // curve25519 functions
 
+// pools of precomputed key pairs (see keypool.c)
+#define KEYPOOL_X25519 0
+#define KEYPOOL_SIGN 1
+extern int keypool_pop(int kind, unsigned char pk[32], unsigned char sk[32]);
+extern int keypool_resize(int size);
+extern void keypool_stats(long *hits, long *misses, int *count);
+extern void keypool_retain(void);
+extern void keypool_release(void);
+
+static int push_keypair(lua_State *L, unsigned char *pk, 
+		unsigned char *sk, int askey) {
+	// push pk and sk (as a string, or the key handle already on the
+	// stack top)
+	lua_pushlstring (L, pk, 32); 
+	if (askey) {
+		lua_insert(L, -2);
+	} else {
+		lua_pushlstring (L, sk, 32); 
+		crypto_wipe(sk, 32);
+	}
+	return 2;
+}
+
 static int ln_x25519_keypair(lua_State *L) {
 	// generate and return a random key pair (publickey, secretkey)
-	// lua api: x25519_keypair()
-	// return (sk, pk)
+	// lua api: x25519_keypair([askey])
+	// askey: if true, sk is returned as a key handle
+	// return (pk, sk)
 	unsigned char pk[32];
-	unsigned char sk[32];
+	unsigned char skbuf[32];
+	int askey = lua_toboolean(L, 1);
+	unsigned char *sk = askey ? new_key(L) : skbuf;
+	// take a key pair from the pool, or
 	// sk is a random string. Then, compute the matching public key
-	randombytes(sk, 32);
-	crypto_x25519_public_key(pk, sk);
-	lua_pushlstring (L, pk, 32); 
-	lua_pushlstring (L, sk, 32); 
-	return 2;
+	if (keypool_pop(KEYPOOL_X25519, pk, sk) != 0) {
+		randombytes(sk, 32);
+		crypto_x25519_public_key(pk, sk);
+	}
+	return push_keypair(L, pk, sk, askey);
 }//ln_x25519_keypair()
 
 static int ln_x25519_public_key(lua_State *L) {
@@ -237,7 +1299,7 @@ static int ln_x25519_public_key(lua_State *L) {
 	// pk: the matching public key
 	size_t skln;
 	unsigned char pk[32];
-	const char *sk = luaL_checklstring(L,1,&skln); // secret key
+	const char *sk = checkbytes(L,1,&skln); // secret key
 	if (skln != 32) LERR("bad sk size");
 	crypto_x25519_public_key(pk, sk);
 	lua_pushlstring (L, pk, 32); 
@@ -246,34 +1308,342 @@ static int ln_x25519_public_key(lua_State *L) {
 
 static int ln_key_exchange(lua_State *L) {
 	// DH key exchange: compute a session key
-	// lua api:  lock_key(sk, pk) => k
+	// lua api:  lock_key(sk, pk [, askey]) => k
 	// !! beware, reversed order compared to nacl box_beforenm() !!
 	// sk: "your" secret key
 	// pk: "their" public key
+	// askey: if true, k is returned as a key handle
 	// return the session key k
 	size_t pkln, skln;
-	unsigned char k[32];
-	const char *sk = luaL_checklstring(L,1,&skln); // your secret key
-	const char *pk = luaL_checklstring(L,2,&pkln); // their public key
+	unsigned char kbuf[32];
+	const char *sk = checkbytes(L,1,&skln); // your secret key
+	const char *pk = checkbytes(L,2,&pkln); // their public key
+	int askey = lua_toboolean(L, 3);
 	if (pkln != 32) LERR("bad pk size");
 	if (skln != 32) LERR("bad sk size");
+	unsigned char *k = askey ? new_key(L) : kbuf;
 	crypto_key_exchange(k, sk, pk);
-	lua_pushlstring(L, k, 32); 
+	if (!askey) {
+		lua_pushlstring(L, k, 32); 
+		crypto_wipe(k, 32);
+	}
 	return 1;   
 }// ln_key_exchange()
 
+static int ln_keypair_pool(lua_State *L) {
+	// get stats about the key pair pools, and optionally resize them
+	// Lua API: keypair_pool([n]) return hits, misses, count
+	//          or (nil, error msg)
+	//  n: optional new number of precomputed key pairs in each pool
+	//     (x25519 and ed25519). The pools are emptied (unused key 
+	//     pairs are wiped), then refilled by a background thread.
+	//     n = 0 disables the pools (default)
+	//  return the number of keypair() / sign_keypair() calls served /
+	//  not served by the pools since they were last resized, and the
+	//  number of key pairs in the pools (before resizing), or nil, 
+	//  error msg if the pools cannot be started
+	long hits, misses;
+	int count;
+	lua_Integer n = luaL_optinteger(L, 1, -1);	// -1: no resizing
+	if ((!lua_isnoneornil(L, 1) && (n < 0)) || (n > (1 << 16))) {
+		luaL_argerror(L, 1, "bad pool size");
+	}
+	keypool_stats(&hits, &misses, &count);
+	if ((n >= 0) && (keypool_resize(n) != 0)) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "cannot start the key pair pools");
+		return 2;
+	}
+	lua_pushinteger(L, hits);
+	lua_pushinteger(L, misses);
+	lua_pushinteger(L, count);
+	return 3;
+} // ln_keypair_pool()
 
 //----------------------------------------------------------------------
-// blake2b hash functions
+// bounded LRU cache
+//
+// fixed-size slots allocated once in an arena. Each slot holds a 32-byte
+// key and a value of 'valsize' bytes. Keys are expected to be uniformly
+// distributed (hash digests, public keys), so their first bytes are
+// used directly as the hash table index.
+// Slots are wiped when they are evicted, removed or freed.
+
+typedef struct {
+	unsigned char key[32];
+	int prev, next;		// LRU list, most recently used first
+	int hnext;		// hash chain
+} lru_slot;
+
+typedef struct {
+	unsigned char *arena;	// nslots * slotsize bytes
+	int *buckets;		// nbuckets hash chain heads
+	size_t slotsize, valsize;
+	int nslots, nbuckets, count;
+	int head, tail, free;	// LRU list ends, free list
+	lua_Integer hits, misses;
+} lru_cache;
+
+#define LRU_SLOT(c, i) ((lru_slot *)((c)->arena + (size_t)(i) * (c)->slotsize))
+#define LRU_VALUE(c, i) ((unsigned char *)LRU_SLOT(c, i) + sizeof(lru_slot))
+
+static int lru_bucket(lru_cache *c, const unsigned char key[32]) {
+	unsigned int h = key[0] | (key[1] << 8) | (key[2] << 16)
+		| ((unsigned int)key[3] << 24);
+	return h & (c->nbuckets - 1);
+}
 
-static int ln_blake2b(lua_State *L) {
+static void lru_reset(lru_cache *c) {
+	// wipe all slots and put them all in the free list
+	crypto_wipe(c->arena, (size_t)c->nslots * c->slotsize);
+	for (int i = 0; i < c->nbuckets; i++) c->buckets[i] = -1;
+	for (int i = 0; i < c->nslots; i++) LRU_SLOT(c, i)->next = i + 1;
+	LRU_SLOT(c, c->nslots - 1)->next = -1;
+	c->free = 0;
+	c->head = c->tail = -1;
+	c->count = 0;
+}
+
+static int lru_init(lru_cache *c, int nslots, size_t valsize) {
+	// return 0 if ok, or -1 if the arena cannot be allocated
+	int nb = 1;
+	while (nb < nslots) nb <<= 1;
+	c->valsize = valsize;
+	// keep slots 8-byte aligned
+	c->slotsize = (sizeof(lru_slot) + valsize + 7) & ~(size_t)7;
+	c->nslots = nslots;
+	c->nbuckets = nb;
+	c->hits = c->misses = 0;
+	c->arena = malloc((size_t)nslots * c->slotsize);
+	c->buckets = malloc(nb * sizeof(int));
+	if ((c->arena == NULL) || (c->buckets == NULL)) {
+		free(c->arena); free(c->buckets);
+		c->arena = NULL; c->buckets = NULL;
+		return -1;
+	}
+	lru_reset(c);
+	return 0;
+}
+
+static void lru_free(lru_cache *c) {
+	if (c->arena == NULL) return;
+	crypto_wipe(c->arena, (size_t)c->nslots * c->slotsize);
+	free(c->arena);
+	free(c->buckets);
+	c->arena = NULL; c->buckets = NULL;
+}
+
+static void lru_unlink(lru_cache *c, int i) {
+	lru_slot *s = LRU_SLOT(c, i);
+	if (s->prev >= 0) LRU_SLOT(c, s->prev)->next = s->next;
+	else c->head = s->next;
+	if (s->next >= 0) LRU_SLOT(c, s->next)->prev = s->prev;
+	else c->tail = s->prev;
+}
+
+static void lru_push_front(lru_cache *c, int i) {
+	lru_slot *s = LRU_SLOT(c, i);
+	s->prev = -1;
+	s->next = c->head;
+	if (c->head >= 0) LRU_SLOT(c, c->head)->prev = i;
+	c->head = i;
+	if (c->tail < 0) c->tail = i;
+}
+
+static int lru_find(lru_cache *c, const unsigned char key[32]) {
+	// return the slot index for key, or -1
+	int i = c->buckets[lru_bucket(c, key)];
+	while ((i >= 0) && (memcmp(LRU_SLOT(c, i)->key, key, 32) != 0)) {
+		i = LRU_SLOT(c, i)->hnext;
+	}
+	return i;
+}
+
+static void lru_drop(lru_cache *c, int i) {
+	// remove slot i from the hash chain and the LRU list,
+	// wipe it and return it to the free list
+	lru_slot *s = LRU_SLOT(c, i);
+	int *pi = &c->buckets[lru_bucket(c, s->key)];
+	while (*pi != i) pi = &LRU_SLOT(c, *pi)->hnext;
+	*pi = s->hnext;
+	lru_unlink(c, i);
+	crypto_wipe(s, c->slotsize);
+	s->next = c->free;
+	c->free = i;
+	c->count--;
+}
+
+static unsigned char *lru_get(lru_cache *c, const unsigned char key[32]) {
+	// return the value associated to key (and make it the most
+	// recently used entry), or NULL if the key is not in the cache
+	int i = lru_find(c, key);
+	if (i < 0) {
+		c->misses++;
+		return NULL;
+	}
+	c->hits++;
+	if (c->head != i) {
+		lru_unlink(c, i);
+		lru_push_front(c, i);
+	}
+	return LRU_VALUE(c, i);
+}
+
+static unsigned char *lru_put(lru_cache *c, const unsigned char key[32]) {
+	// insert key in the cache (the caller checked it is not there yet)
+	// evict the least recently used entry if the cache is full.
+	// return the value area for key, to be filled by the caller
+	if (c->free < 0) lru_drop(c, c->tail);
+	int i = c->free;
+	lru_slot *s = LRU_SLOT(c, i);
+	c->free = s->next;
+	memcpy(s->key, key, 32);
+	int b = lru_bucket(c, key);
+	s->hnext = c->buckets[b];
+	c->buckets[b] = i;
+	lru_push_front(c, i);
+	c->count++;
+	return LRU_VALUE(c, i);
+}
+
+static int lru_remove(lru_cache *c, const unsigned char key[32]) {
+	// remove key from the cache. return 1 if it was there, else 0
+	int i = lru_find(c, key);
+	if (i < 0) return 0;
+	lru_drop(c, i);
+	return 1;
+}
+
+//----------------------------------------------------------------------
+// shared key cache - a bounded LRU cache of key_exchange() results
+//
+// entries are keyed by a keyed blake2b hash of (sk, pk). The hash key
+// is random and specific to each cache object.
+
+#define KEY_CACHE_MT "luanacha.key_cache"
+
+typedef struct {
+	lru_cache lru;
+	unsigned char hkey[32];	// random key for the entry hashes
+} key_cache;
+
+static void key_cache_tag(key_cache *kc, unsigned char tag[32],
+		const char *sk, const char *pk) {
+	crypto_blake2b_ctx ctx;
+	crypto_blake2b_general_init(&ctx, 32, kc->hkey, 32);
+	crypto_blake2b_update(&ctx, sk, 32);
+	crypto_blake2b_update(&ctx, pk, 32);
+	crypto_blake2b_final(&ctx, tag);
+}
+
+static key_cache *check_key_cache(lua_State *L, int i) {
+	key_cache *kc = luaL_checkudata(L, i, KEY_CACHE_MT);
+	if (kc->lru.arena == NULL) luaL_error(L, "key cache has been freed");
+	return kc;
+}
+
+static void check_key_pair(lua_State *L, const char **sk, const char **pk) {
+	// get (sk, pk) at index 2 and 3 (after the cache object)
+	size_t pkln, skln;
+	*sk = checkbytes(L,2,&skln); // your secret key
+	*pk = checkbytes(L,3,&pkln); // their public key
+	if (pkln != 32) luaL_error(L, "bad pk size");
+	if (skln != 32) luaL_error(L, "bad sk size");
+}
+
+static int ln_key_cache(lua_State *L) {
+	// create a shared key cache
+	// lua api:  key_cache(n) => kc
+	// n: max number of session keys kept in the cache
+	// return kc, a key cache object
+	lua_Integer n = luaL_checkinteger(L, 1);
+	if ((n < 1) || (n > (1 << 24))) LERR("bad cache size");
+	key_cache *kc = lua_newuserdata(L, sizeof(key_cache));
+	kc->lru.arena = NULL;
+	luaL_getmetatable(L, KEY_CACHE_MT);
+	lua_setmetatable(L, -2);
+	if (randombytes(kc->hkey, 32) != 0) LERR("random generator error");
+	if (lru_init(&kc->lru, (int)n, 32) != 0) LERR("out of memory");
+	return 1;
+}// ln_key_cache()
+
+static int ln_key_cache_key_exchange(lua_State *L) {
+	// DH key exchange through the cache
+	// lua api:  kc:key_exchange(sk, pk) => k
+	// same as key_exchange(sk, pk), but k is taken from the cache
+	// if the (sk, pk) pair has been seen recently
+	const char *sk, *pk;
+	unsigned char tag[32];
+	key_cache *kc = check_key_cache(L, 1);
+	check_key_pair(L, &sk, &pk);
+	key_cache_tag(kc, tag, sk, pk);
+	unsigned char *k = lru_get(&kc->lru, tag);
+	if (k == NULL) {
+		k = lru_put(&kc->lru, tag);
+		crypto_key_exchange(k, sk, pk);
+	}
+	lua_pushlstring(L, k, 32);
+	return 1;
+}// ln_key_cache_key_exchange()
+
+static int ln_key_cache_invalidate(lua_State *L) {
+	// remove a session key from the cache
+	// lua api:  kc:invalidate([sk, pk]) => boolean
+	// if sk and pk are not provided, all the entries are removed
+	// return true if an entry has been removed
+	const char *sk, *pk;
+	unsigned char tag[32];
+	key_cache *kc = check_key_cache(L, 1);
+	if (lua_isnoneornil(L, 2)) {
+		int count = kc->lru.count;
+		lru_reset(&kc->lru);
+		lua_pushboolean(L, count > 0);
+		return 1;
+	}
+	check_key_pair(L, &sk, &pk);
+	key_cache_tag(kc, tag, sk, pk);
+	lua_pushboolean(L, lru_remove(&kc->lru, tag));
+	return 1;
+}// ln_key_cache_invalidate()
+
+static int ln_key_cache_stats(lua_State *L) {
+	// lua api:  kc:stats() => hits, misses, count
+	// hits, misses: number of lookups found / not found in the cache
+	// count: number of entries currently in the cache
+	key_cache *kc = check_key_cache(L, 1);
+	lua_pushinteger(L, kc->lru.hits);
+	lua_pushinteger(L, kc->lru.misses);
+	lua_pushinteger(L, kc->lru.count);
+	return 3;
+}// ln_key_cache_stats()
+
+static int ln_key_cache_gc(lua_State *L) {
+	key_cache *kc = luaL_checkudata(L, 1, KEY_CACHE_MT);
+	lru_free(&kc->lru);
+	crypto_wipe(kc->hkey, 32);
+	return 0;
+}
+
+static const struct luaL_Reg key_cache_methods[] = {
+	{"key_exchange", ln_key_cache_key_exchange},
+	{"invalidate", ln_key_cache_invalidate},
+	{"stats", ln_key_cache_stats},
+	{"__gc", ln_key_cache_gc},
+	{NULL, NULL},
+};
+
+
+//----------------------------------------------------------------------
+// blake2b hash functions
+
+static int ln_blake2b(lua_State *L) {
 	// compute the hash of a string (convenience function)
 	// with default parameters (64-byte digest, no key)
 	// lua api:  blake2b(m) return digest
 	// m: the string to be hashed
 	// digest: the blake2b hash (a 64-byte string)
     size_t mln; 
-    const char *m = luaL_checklstring (L, 1, &mln);
+    const char *m = checkbytes (L, 1, &mln);
     char digest[64];
     crypto_blake2b_general(digest, 64, 0, 0, m, mln);
     lua_pushlstring (L, digest, 64); 
@@ -296,7 +1666,7 @@ static int ln_blake2b_init(lua_State *L) {
 	//
     size_t keyln = 0; 
     int digln = luaL_optinteger(L, 1, 64);
-    const char *key = luaL_optlstring(L, 2, NULL, &keyln);
+    const char *key = optbytes(L, 2, NULL, &keyln);
 	if ((keyln < 0)||(keyln > 64)) LERR("bad key size");
 	if ((digln < 1)||(digln > 64)) LERR("bad digest size");
     size_t ctxln = sizeof(crypto_blake2b_ctx);
@@ -315,7 +1685,7 @@ static int ln_blake2b_update(lua_State *L) {
 	//
 	size_t tln; 
 	crypto_blake2b_ctx *ctx = (crypto_blake2b_ctx *) lua_touserdata(L, 1);
-    const char *t = luaL_checklstring (L, 2, &tln);
+    const char *t = checkbytes (L, 2, &tln);
 	if (ctx == NULL) LERR("invalid ctx");	
     crypto_blake2b_update(ctx, t, tln);
     return 0;
@@ -346,15 +1716,19 @@ static int ln_blake2b_final(lua_State *L) {
 
 static int ln_sign_keypair(lua_State *L) {
 	// generates and return a pair of ed25519 signature keys 
-	// lua api: sign_keypair()  return (sk, pk)
+	// lua api: sign_keypair([askey])  return (pk, sk)
+	// askey: if true, sk is returned as a key handle
 	unsigned char pk[32];
-	unsigned char sk[32];
+	unsigned char skbuf[32];
+	int askey = lua_toboolean(L, 1);
+	unsigned char *sk = askey ? new_key(L) : skbuf;
+	// take a key pair from the pool, or
 	// sk is a random string. Then, compute the matching public key
-	randombytes(sk, 32);
-	crypto_sign_public_key(pk, sk);
-	lua_pushlstring (L, pk, 32); 
-	lua_pushlstring (L, sk, 32); 
-	return 2;
+	if (keypool_pop(KEYPOOL_SIGN, pk, sk) != 0) {
+		randombytes(sk, 32);
+		crypto_sign_public_key(pk, sk);
+	}
+	return push_keypair(L, pk, sk, askey);
 }//ln_sign_keypair()
 
 static int ln_sign_public_key(lua_State *L) {
@@ -364,7 +1738,7 @@ static int ln_sign_public_key(lua_State *L) {
 	// pk: the matching public key
 	size_t skln;
 	unsigned char pk[32];
-	const char *sk = luaL_checklstring(L,1,&skln); // secret key
+	const char *sk = checkbytes(L,1,&skln); // secret key
 	if (skln != 32) LERR("bad sk size");
 	crypto_sign_public_key(pk, sk);
 	lua_pushlstring (L, pk, 32); 
@@ -379,9 +1753,9 @@ static int ln_sign(lua_State *L) {
 	//	m: message to sign (string)
 	//  return signature (a 64-byte string)
 	size_t mln, skln, pkln;
-	const char *sk = luaL_checklstring(L,1,&skln);
-	const char *pk = luaL_checklstring(L,2,&pkln);
-	const char *m = luaL_checklstring(L,3,&mln);	
+	const char *sk = checkbytes(L,1,&skln);
+	const char *pk = checkbytes(L,2,&pkln);
+	const char *m = checkbytes(L,3,&mln);	
 	if (skln != 32) LERR("bad key size");
 	if (pkln != 32) LERR("bad pub key size");
 	unsigned char sig[64];
@@ -390,6 +1764,64 @@ static int ln_sign(lua_State *L) {
 	return 1;
 } // ln_sign()
 
+//----------------------------------------------------------------------
+// signer objects - signature with an expanded secret key
+//
+// a signer holds the secret scalar, the nonce prefix and the public key
+// derived from a secret key. They are wiped when the signer is
+// collected.
+
+#define SIGNER_MT "luanacha.signer"
+
+static int ln_signer(lua_State *L) {
+	// create a signer object for a secret key
+	// Lua API: signer(sk) return s
+	//  sk: key string (32 bytes)
+	//  return s, a signer object
+	size_t skln;
+	const char *sk = checkbytes(L,1,&skln);
+	if (skln != 32) LERR("bad key size");
+	crypto_sign_key *key = lua_newuserdata(L, sizeof(crypto_sign_key));
+	crypto_sign_key_init(key, sk);
+	luaL_getmetatable(L, SIGNER_MT);
+	lua_setmetatable(L, -2);
+	return 1;
+} // ln_signer()
+
+static int ln_signer_sign(lua_State *L) {
+	// sign a text
+	// Lua API: s:sign(m) return sig
+	//	m: message to sign (string)
+	//  return signature (a 64-byte string)
+	size_t mln;
+	crypto_sign_key *key = luaL_checkudata(L, 1, SIGNER_MT);
+	const char *m = checkbytes(L,2,&mln);
+	unsigned char sig[64];
+	crypto_sign_with_key(sig, key, m, mln);
+	lua_pushlstring (L, sig, 64);
+	return 1;
+} // ln_signer_sign()
+
+static int ln_signer_public_key(lua_State *L) {
+	// Lua API: s:public_key() return pk
+	crypto_sign_key *key = luaL_checkudata(L, 1, SIGNER_MT);
+	lua_pushlstring (L, key->pk, 32);
+	return 1;
+} // ln_signer_public_key()
+
+static int ln_signer_gc(lua_State *L) {
+	crypto_sign_key *key = luaL_checkudata(L, 1, SIGNER_MT);
+	crypto_wipe(key, sizeof(crypto_sign_key));
+	return 0;
+}
+
+static const struct luaL_Reg signer_methods[] = {
+	{"sign", ln_signer_sign},
+	{"public_key", ln_signer_public_key},
+	{"__gc", ln_signer_gc},
+	{NULL, NULL},
+};
+
 static int ln_check(lua_State *L) {
 	// check a text signature with a public key
 	// Lua API: check(sig, pk, m) return boolean
@@ -399,9 +1831,9 @@ static int ln_check(lua_State *L) {
 	//  return true if the signature match, or false
 	int r;
 	size_t mln, pkln, sigln;
-	const char *sig = luaL_checklstring(L,1,&sigln);
-	const char *pk = luaL_checklstring(L,2,&pkln);
-	const char *m = luaL_checklstring(L,3,&mln);	
+	const char *sig = checkbytes(L,1,&sigln);
+	const char *pk = checkbytes(L,2,&pkln);
+	const char *m = checkbytes(L,3,&mln);	
 	if (sigln != 64) LERR("bad signature size");
 	if (pkln != 32) LERR("bad key size");
 	r = crypto_check(sig, pk, m, mln);
@@ -410,35 +1842,1961 @@ static int ln_check(lua_State *L) {
 	return 1;
 } // ln_check()
 
+static int ln_check_batch(lua_State *L) {
+	// check a list of text signatures
+	// Lua API: check_batch(sigs, pks, ms) return list of booleans
+	//  sigs: list of signature strings (64 bytes)
+	//  pks: list of public key strings (32 bytes)
+	//	ms: list of messages to verify (strings)
+	//  return a list of booleans, true where the signature matches
+	// signatures are verified together by groups of
+	// CRYPTO_CHECK_BATCH_MAX. If a group fails, its signatures are
+	// checked one by one to find the invalid ones.
+	size_t sigln, pkln;
+	const unsigned char *sigs[CRYPTO_CHECK_BATCH_MAX];
+	const unsigned char *pks[CRYPTO_CHECK_BATCH_MAX];
+	const unsigned char *ms[CRYPTO_CHECK_BATCH_MAX];
+	size_t mlns[CRYPTO_CHECK_BATCH_MAX];
+	unsigned char rnd[CRYPTO_CHECK_BATCH_MAX * 16];
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	int nb = lua_objlen(L, 1);
+	if ((lua_objlen(L, 2) != nb) || (lua_objlen(L, 3) != nb))
+		LERR("list sizes differ");
+	// the work area (about 100KB) is not allocated on the stack: the
+	// function also runs in the async threads
+	void *work = lua_newuserdata(L, CRYPTO_CHECK_BATCH_WORK_SIZE);
+	lua_createtable(L, nb, 0);	// result at index 5
+	for (int i = 0; i < nb; i += CRYPTO_CHECK_BATCH_MAX) {
+		int n = nb - i;
+		if (n > CRYPTO_CHECK_BATCH_MAX) n = CRYPTO_CHECK_BATCH_MAX;
+		// the items stay referenced by the argument lists
+		for (int j = 0; j < n; j++) {
+			lua_rawgeti(L, 1, i + j + 1);
+			lua_rawgeti(L, 2, i + j + 1);
+			lua_rawgeti(L, 3, i + j + 1);
+			sigs[j] = checkitem(L, -3, &sigln);
+			pks[j] = checkitem(L, -2, &pkln);
+			ms[j] = checkitem(L, -1, &mlns[j]);
+			if (sigln != 64) LERR("bad signature size");
+			if (pkln != 32) LERR("bad key size");
+			lua_pop(L, 3);
+		}
+		if (randombytes(rnd, n * 16) != 0) LERR("random generator error");
+		int r = crypto_check_batch(sigs, pks, ms, mlns, n, rnd, work);
+		for (int j = 0; j < n; j++) {
+			lua_pushboolean(L, (r == 0) ||
+				(crypto_check(sigs[j], pks[j], ms[j], mlns[j]) == 0));
+			lua_rawseti(L, 5, i + j + 1);
+		}
+	}
+	return 1;
+} // ln_check_batch()
+
+//----------------------------------------------------------------------
+// verifier objects - signature check with a precomputed public key
+//
+// a verifier holds the decompressed public key and its look up table,
+// so that check() does not have to compute them for each signature.
+// Recently created verifiers are kept in a process-wide LRU cache
+// keyed by public key (shared by all the Lua states and threads of
+// the process: it is protected by a mutex).
+// The key is accessed through a pointer: verifiers created from a key
+// store (see below) point directly into the keys loaded from the file.
+
+#define VERIFIER_MT "luanacha.verifier"
+#define VERIFIER_CACHE_SIZE 256	// default number of cached verifiers
+
+static lru_cache verifier_lru;
+static int verifier_lru_size = VERIFIER_CACHE_SIZE;
+
+#ifdef _WIN32
+#define verifier_lru_lock()
+#define verifier_lru_unlock()
+#else
+static pthread_mutex_t verifier_lru_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define verifier_lru_lock() pthread_mutex_lock(&verifier_lru_mutex)
+#define verifier_lru_unlock() pthread_mutex_unlock(&verifier_lru_mutex)
+#endif
+
+typedef struct {
+	const crypto_check_key *key;	// &own, or a key in a key store
+	crypto_check_key own;
+} verifier;
+
+static verifier *new_verifier(lua_State *L, const crypto_check_key *key) {
+	// push a new verifier. If key is NULL, the verifier has its own
+	// key (to be initialized), else it uses key, which must remain
+	// valid as long as the verifier.
+	verifier *v;
+	if (key == NULL) {
+		v = lua_newuserdata(L, sizeof(verifier));
+		v->key = &v->own;
+	} else {
+		v = lua_newuserdata(L, sizeof(const crypto_check_key *));
+		v->key = key;
+	}
+	luaL_getmetatable(L, VERIFIER_MT);
+	lua_setmetatable(L, -2);
+	return v;
+}
+
+static int verifier_key_init(crypto_check_key *key, const char *pk) {
+	// initialize key for public key pk, through the verifier cache
+	// return 0 if ok, or -1 if pk is not a valid public key
+	// (the key is decompressed without holding the cache lock)
+	unsigned char *cached = NULL;
+	verifier_lru_lock();
+	if ((verifier_lru.arena == NULL) && (verifier_lru_size > 0)) {
+		lru_init(&verifier_lru, verifier_lru_size,
+			sizeof(crypto_check_key));
+	}
+	if (verifier_lru.arena != NULL) {
+		cached = lru_get(&verifier_lru, pk);
+	}
+	if (cached != NULL) {
+		memcpy(key, cached, sizeof(crypto_check_key));
+		verifier_lru_unlock();
+		return 0;
+	}
+	verifier_lru_unlock();
+	if (crypto_check_key_init(key, pk) != 0) return -1;
+	verifier_lru_lock();
+	if ((verifier_lru.arena != NULL) && 
+			(lru_find(&verifier_lru, pk) < 0)) { // (not added meanwhile)
+		cached = lru_put(&verifier_lru, pk);
+		memcpy(cached, key, sizeof(crypto_check_key));
+	}
+	verifier_lru_unlock();
+	return 0;
+}
+
+static int ln_verifier(lua_State *L) {
+	// create a verifier object for a public key
+	// Lua API: verifier(pk) return v  or (nil, error msg)
+	//  pk: public key string (32 bytes)
+	//  return v, a verifier object, or nil, error msg if pk is not
+	//  a valid public key
+	size_t pkln;
+	const char *pk = checkbytes(L,1,&pkln);
+	if (pkln != 32) LERR("bad key size");
+	verifier *v = new_verifier(L, NULL);
+	if (verifier_key_init(&v->own, pk) != 0) {
+		lua_pushnil (L);
+		lua_pushliteral(L, "invalid public key");
+		return 2;
+	}
+	return 1;
+} // ln_verifier()
+
+static int ln_verifier_check(lua_State *L) {
+	// check a text signature
+	// Lua API: v:check(sig, m) return boolean
+	//  sig: signature string (64 bytes)
+	//	m: message to verify (string)
+	//  return true if the signature match, or false
+	size_t mln, sigln;
+	verifier *v = luaL_checkudata(L, 1, VERIFIER_MT);
+	const char *sig = checkbytes(L,2,&sigln);
+	const char *m = checkbytes(L,3,&mln);
+	if (sigln != 64) LERR("bad signature size");
+	int r = crypto_check_with_key(sig, v->key, m, mln);
+	lua_pushboolean (L, (r == 0));
+	return 1;
+} // ln_verifier_check()
+
+static int ln_verifier_public_key(lua_State *L) {
+	// Lua API: v:public_key() return pk
+	verifier *v = luaL_checkudata(L, 1, VERIFIER_MT);
+	lua_pushlstring (L, v->key->pk, 32);
+	return 1;
+} // ln_verifier_public_key()
+
+static const struct luaL_Reg verifier_methods[] = {
+	{"check", ln_verifier_check},
+	{"public_key", ln_verifier_public_key},
+	{NULL, NULL},
+};
+
+static int ln_verifier_cache(lua_State *L) {
+	// get stats about the verifier cache, and optionally resize it
+	// Lua API: verifier_cache([n]) return hits, misses, count
+	//  n: optional new max number of cached verifiers. The cache is
+	//     emptied. n = 0 disables the cache. Default size is 256
+	//  return the number of verifier() calls which have been
+	//  served / not served by the cache, and the number of cached
+	//  verifiers (before resizing)
+	lua_Integer n = luaL_optinteger(L, 1, -1);
+	if (n > (1 << 20)) LERR("bad cache size");
+	verifier_lru_lock();
+	lua_Integer hits = verifier_lru.hits, misses = verifier_lru.misses;
+	int count = verifier_lru.count;
+	if (n >= 0) {
+		lru_free(&verifier_lru);
+		verifier_lru.hits = verifier_lru.misses = 0;
+		verifier_lru.count = 0;
+		verifier_lru_size = n;
+	}
+	verifier_lru_unlock();
+	lua_pushinteger(L, hits);
+	lua_pushinteger(L, misses);
+	lua_pushinteger(L, count);
+	return 3;
+} // ln_verifier_cache()
+
+//----------------------------------------------------------------------
+// verifier key store - decompressed public keys saved in a file
+//
+// a key store is a local cache which saves the decompression of known
+// public keys when a process starts. File layout (integers are 32-bit,
+// in the byte order of the machine which built the file):
+//   0  magic "LNKSTORE"
+//   8  version (2)
+//  12  byte order mark (0x01020304)
+//  16  entry size (sizeof(crypto_check_key))
+//  20  number of entries
+//  24  reserved (0)
+//  32  MAC: blake2b keyed with a 32-byte secret key (32 bytes) of 
+//      bytes 0-31 and of the entries
+//  64  entries (crypto_check_key), sorted by public key
+// The entries are precomputed tables trusted by the verifiers: a 
+// modified table could make a forged signature valid. So the store is
+// authenticated with a secret key, and it is read in private memory 
+// when it is opened (later changes to the file are not seen). 
+// Verifiers created from the store use the keys of this copy.
+
+#define KEYSTORE_MT "luanacha.keystore"
+#define KEYSTORE_MAGIC "LNKSTORE"
+#define KEYSTORE_VERSION 2
+#define KEYSTORE_BOM 0x01020304
+#define KEYSTORE_HEADER 64
+
+typedef struct {
+	unsigned char *base;	// file content (private copy), or NULL
+	size_t size;
+	uint32_t count;     	// number of keys
+	const crypto_check_key *keys;
+} keystore;
+
+static void keystore_mac(const unsigned char key[32], 
+		const unsigned char *header, const crypto_check_key *keys, 
+		size_t count, unsigned char mac[32]) {
+	crypto_blake2b_ctx ctx;
+	crypto_blake2b_general_init(&ctx, 32, key, 32);
+	crypto_blake2b_update(&ctx, header, 32);
+	crypto_blake2b_update(&ctx, (const unsigned char *) keys,
+		count * sizeof(crypto_check_key));
+	crypto_blake2b_final(&ctx, mac);
+}
+
+static void keystore_close(keystore *ks) {
+	if (ks->base == NULL) return;
+	free(ks->base);
+	ks->base = NULL;
+	ks->count = 0;
+}
+
+static const char *keystore_open(keystore *ks, const char *path,
+		const unsigned char key[32]) {
+	// load a key store file. return NULL, or an error message 
+	// (errno is set to 0 if the file is not a valid key store)
+	uint32_t h[6];
+	unsigned char mac[32];
+	ks->base = NULL;
+	ks->count = 0;
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) return strerror(errno);
+	if ((fseek(f, 0, SEEK_END) != 0) || (ftell(f) < 0)) {
+		fclose(f);
+		return strerror(errno);
+	}
+	ks->size = ftell(f);
+	if (ks->size < KEYSTORE_HEADER) {
+		fclose(f);
+		errno = 0;
+		return "not a key store";
+	}
+	ks->base = malloc(ks->size);
+	rewind(f);
+	if ((ks->base == NULL) || 
+			(fread(ks->base, 1, ks->size, f) != ks->size)) {
+		free(ks->base);
+		ks->base = NULL;
+		fclose(f);
+		return "cannot read the key store";
+	}
+	fclose(f);
+	memcpy(h, ks->base + 8, sizeof(h));
+	if ((memcmp(ks->base, KEYSTORE_MAGIC, 8) != 0) 
+			|| (h[0] != KEYSTORE_VERSION) || (h[1] != KEYSTORE_BOM)
+			|| (h[2] != sizeof(crypto_check_key))
+			|| ((ks->size - KEYSTORE_HEADER) / sizeof(crypto_check_key)
+				!= h[3])
+			|| ((ks->size - KEYSTORE_HEADER) % sizeof(crypto_check_key)
+				!= 0)) {
+		keystore_close(ks);
+		errno = 0;
+		return "not a key store, or incompatible key store";
+	}
+	ks->keys = (const crypto_check_key *) (ks->base + KEYSTORE_HEADER);
+	keystore_mac(key, ks->base, ks->keys, h[3], mac);
+	if (crypto_verify32(mac, ks->base + 32) != 0) {
+		keystore_close(ks);
+		errno = 0;
+		return "key store authentication error (wrong key or modified"
+			" file)";
+	}
+	ks->count = h[3];
+	return NULL;
+}
+
+static const crypto_check_key *keystore_find(const keystore *ks,
+		const unsigned char *pk) {
+	// binary search. return the key for pk, or NULL
+	size_t lo = 0, hi = ks->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int c = memcmp(pk, ks->keys[mid].pk, 32);
+		if (c == 0) return &ks->keys[mid];
+		if (c < 0) hi = mid; else lo = mid + 1;
+	}
+	return NULL;
+}
+
+static int cmp_key_ptr(const void *a, const void *b) {
+	const crypto_check_key *ka = *(const crypto_check_key **) a;
+	const crypto_check_key *kb = *(const crypto_check_key **) b;
+	return memcmp(ka->pk, kb->pk, 32);
+}
+
+static int ln_keystore(lua_State *L) {
+	// open a key store
+	// Lua API: keystore(k, path) return ks  or (nil, error msg)
+	//  k: the secret key of the store (32 bytes)
+	//  path: key store file name (created with keystore_build())
+	//  return ks, a key store object, or nil, error msg if the file 
+	//  cannot be read or is not a valid key store for k
+	size_t kln;
+	const char *k = checkbytes(L,1,&kln);
+	const char *path = luaL_checkstring(L, 2);
+	if (kln != 32) LERR("bad key size");
+	keystore *ks = lua_newuserdata(L, sizeof(keystore));
+	ks->base = NULL;
+	luaL_getmetatable(L, KEYSTORE_MT);
+	lua_setmetatable(L, -2);
+	const char *msg = keystore_open(ks, path, k);
+	if (msg != NULL) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", path, msg);
+		return 2;
+	}
+	return 1;
+} // ln_keystore()
+
+static int ln_keystore_verifier(lua_State *L) {
+	// create a verifier from a key store
+	// Lua API: ks:verifier(pk) return v  or (nil, error msg)
+	//  pk: public key string (32 bytes)
+	//  return v, a verifier object using the key in the store
+	//  (no copy, the store remains open while v is used), or nil, 
+	//  error msg if pk is not in the store
+	size_t pkln;
+	keystore *ks = luaL_checkudata(L, 1, KEYSTORE_MT);
+	const char *pk = checkbytes(L,2,&pkln);
+	if (pkln != 32) LERR("bad key size");
+	const crypto_check_key *key = keystore_find(ks, pk);
+	if (key == NULL) {
+		lua_pushnil (L);
+		lua_pushliteral(L, "unknown public key");
+		return 2;
+	}
+	new_verifier(L, key);
+	// the verifier keeps a reference to the store
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, 1);
+	lua_setfenv(L, -2);
+	return 1;
+} // ln_keystore_verifier()
+
+static int ln_keystore_count(lua_State *L) {
+	// Lua API: ks:count() return number of keys in the store
+	keystore *ks = luaL_checkudata(L, 1, KEYSTORE_MT);
+	lua_pushinteger(L, ks->count);
+	return 1;
+} // ln_keystore_count()
+
+static int ln_keystore_gc(lua_State *L) {
+	keystore *ks = luaL_checkudata(L, 1, KEYSTORE_MT);
+	keystore_close(ks);
+	return 0;
+}
+
+static const struct luaL_Reg keystore_methods[] = {
+	{"verifier", ln_keystore_verifier},
+	{"count", ln_keystore_count},
+	{"__gc", ln_keystore_gc},
+	{NULL, NULL},
+};
+
+static int ln_keystore_build(lua_State *L) {
+	// create or update a key store
+	// Lua API: keystore_build(k, path, pks) return count, added 
+	//           or (nil, error msg)
+	//  k: the secret key of the store (32 bytes), used to
+	//     authenticate it
+	//  path: key store file name. If the file exists, the keys it
+	//     contains are kept (they are not decompressed again)
+	//  pks: list of public key strings (32 bytes) to add to the store
+	//  return the number of keys in the store and the number of keys
+	//  added, or nil, error msg (the store is then unchanged)
+	size_t pkln, kln;
+	keystore old;
+	const char *key = checkbytes(L,1,&kln);
+	const char *path = luaL_checkstring(L, 2);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	if (kln != 32) LERR("bad key size");
+	size_t nb = lua_objlen(L, 3);
+	const char *msg = keystore_open(&old, path, key);
+	if ((msg != NULL) && (errno != ENOENT)) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", path, msg);
+		return 2;
+	}
+	// decompress the new keys (scratch buffer collected by Lua)
+	crypto_check_key *keys = lua_newuserdata(L, 
+		nb * (sizeof(crypto_check_key) + sizeof(crypto_check_key *)));
+	const crypto_check_key **sorted = 
+		(const crypto_check_key **) (keys + nb);
+	size_t added = 0;
+	for (size_t i = 0; i < nb; i++) {
+		lua_rawgeti(L, 3, i + 1);
+		const char *pk = tobytes(L, -1, &pkln);
+		lua_pop(L, 1); // pk is still referenced by the list
+		if ((pk == NULL) || (pkln != 32)) {
+			keystore_close(&old);
+			LERR("bad key size");
+		}
+		if (keystore_find(&old, pk) != NULL) continue;
+		if (crypto_check_key_init(&keys[added], pk) != 0) {
+			keystore_close(&old);
+			lua_pushnil(L);
+			lua_pushfstring(L, "invalid public key (#%d)", (int) i + 1);
+			return 2;
+		}
+		sorted[added] = &keys[added];
+		added++;
+	}
+	qsort(sorted, added, sizeof(crypto_check_key *), cmp_key_ptr);
+	size_t n = 0;	// remove duplicates
+	for (size_t i = 0; i < added; i++) {
+		if ((n == 0) || (cmp_key_ptr(&sorted[n-1], &sorted[i]) != 0)) {
+			sorted[n++] = sorted[i];
+		}
+	}
+	added = n;
+	// write the merged store in a temporary file, then rename it
+	uint32_t h[6] = { KEYSTORE_VERSION, KEYSTORE_BOM, 
+		sizeof(crypto_check_key), old.count + added, 0, 0 };
+	unsigned char header[KEYSTORE_HEADER] = {0};
+	unsigned char mac[32];
+	crypto_blake2b_ctx ctx;
+	memcpy(header, KEYSTORE_MAGIC, 8);
+	memcpy(header + 8, h, sizeof(h));
+	crypto_blake2b_general_init(&ctx, 32, key, 32);
+	crypto_blake2b_update(&ctx, header, 32);
+	lua_pushfstring(L, "%s.tmp", path);
+	const char *tmp = lua_tostring(L, -1);
+	FILE *f = fopen(tmp, "wb");
+	int ok = (f != NULL) && (fwrite(header, 1, KEYSTORE_HEADER, f) 
+		== KEYSTORE_HEADER);
+	size_t i = 0, j = 0;
+	while (ok && ((i < old.count) || (j < added))) {
+		const crypto_check_key *k;
+		if ((j == added) || ((i < old.count) && 
+				(memcmp(old.keys[i].pk, sorted[j]->pk, 32) < 0))) {
+			k = &old.keys[i++];
+		} else {
+			k = sorted[j++];
+		}
+		crypto_blake2b_update(&ctx, (const unsigned char *) k, 
+			sizeof(crypto_check_key));
+		ok = fwrite(k, sizeof(crypto_check_key), 1, f) == 1;
+	}
+	crypto_blake2b_final(&ctx, mac);
+	ok = ok && (fseek(f, 32, SEEK_SET) == 0) 
+		&& (fwrite(mac, 1, 32, f) == 32);
+	if (f != NULL) ok = (fclose(f) == 0) && ok;
+	keystore_close(&old);
+#ifdef _WIN32
+	if (ok) remove(path);	// rename() does not replace files
+#endif
+	if (!ok || (rename(tmp, path) != 0)) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", tmp, strerror(errno));
+		remove(tmp);
+		return 2;
+	}
+	lua_pushinteger(L, h[3]);
+	lua_pushinteger(L, added);
+	return 2;
+} // ln_keystore_build()
+
+//----------------------------------------------------------------------
+// parallel signature and verification
+//
+// the work is split across the native worker pool (see workpool.c).
+// All the arguments are checked and collected before the job starts,
+// and results are pushed after it ends: the workers do not use the
+// Lua state. Strings stay referenced by the argument lists while the
+// job runs.
+
+typedef void (*workpool_fn)(void *arg, size_t first, size_t last);
+extern int workpool_threads(int n);
+extern size_t workpool_grain(size_t grain);
+extern void workpool_run(workpool_fn fn, void *arg, size_t n, size_t grain);
+extern void workpool_retain(void);
+extern void workpool_release(void);
+extern void asyncpool_retain(void);	// (see the async jobs below)
+extern void asyncpool_release(void);
+
+#define THREADS_MT "luanacha.threads"
+
+typedef struct {
+	const crypto_sign_key *key;
+	const unsigned char **ms;
+	size_t *mlns;
+	unsigned char *sigs;	// 64 bytes per message
+} sign_job;
+
+static void sign_range(void *arg, size_t first, size_t last) {
+	sign_job *job = arg;
+	crypto_sign_many_with_key(job->sigs + first * 64, job->key,
+		job->ms + first, job->mlns + first, last - first);
+}
+
+static int ln_sign_many(lua_State *L) {
+	// sign a list of texts with a signer, using the worker pool
+	// Lua API: sign_many(s, ms) return list of signatures
+	//  s: a signer object
+	//  ms: list of messages to sign (strings)
+	//  return a list of signatures (64-byte strings), in the order
+	//  of the messages
+	sign_job job;
+	job.key = luaL_checkudata(L, 1, SIGNER_MT);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	size_t nb = lua_objlen(L, 2);
+	// scratch buffer, collected with the other temporaries
+	unsigned char *scratch = lua_newuserdata(L,
+		nb * (sizeof(char *) + sizeof(size_t) + 64));
+	job.ms = (const unsigned char **) scratch;
+	job.mlns = (size_t *) (scratch + nb * sizeof(char *));
+	job.sigs = scratch + nb * (sizeof(char *) + sizeof(size_t));
+	for (size_t i = 0; i < nb; i++) {
+		lua_rawgeti(L, 2, i + 1);
+		job.ms[i] = checkitem(L, -1, &job.mlns[i]);
+		lua_pop(L, 1); // the text stays referenced by the list
+	}
+	workpool_run(sign_range, &job, nb, 0);
+	lua_createtable(L, nb, 0);
+	for (size_t i = 0; i < nb; i++) {
+		lua_pushlstring(L, job.sigs + i * 64, 64);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+} // ln_sign_many()
+
+typedef struct {
+	const unsigned char **sigs;
+	const unsigned char **pks;
+	const unsigned char **ms;
+	size_t *mlns;
+	unsigned char *ok;
+} check_job;
+
+static void check_range(void *arg, size_t first, size_t last) {
+	check_job *job = arg;
+	for (size_t i = first; i < last; i++) {
+		job->ok[i] = (crypto_check(job->sigs[i], job->pks[i],
+			job->ms[i], job->mlns[i]) == 0);
+	}
+}
+
+static int ln_check_many(lua_State *L) {
+	// check a list of text signatures, using the worker pool
+	// Lua API: check_many(ts) return list of booleans
+	//  ts: list of {sig, pk, m} triples
+	//  return a list of booleans, true where the signature matches,
+	//  in the order of the triples
+	check_job job;
+	size_t sigln, pkln;
+	luaL_checktype(L, 1, LUA_TTABLE);
+	size_t nb = lua_objlen(L, 1);
+	unsigned char *scratch = lua_newuserdata(L,
+		nb * (3 * sizeof(char *) + sizeof(size_t) + 1));
+	job.sigs = (const unsigned char **) scratch;
+	job.pks = job.sigs + nb;
+	job.ms = job.pks + nb;
+	job.mlns = (size_t *) (job.ms + nb);
+	job.ok = (unsigned char *) (job.mlns + nb);
+	for (size_t i = 0; i < nb; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		if (!lua_istable(L, -1)) LERR("triple expected");
+		lua_rawgeti(L, -1, 1);
+		lua_rawgeti(L, -2, 2);
+		lua_rawgeti(L, -3, 3);
+		job.sigs[i] = checkitem(L, -3, &sigln);
+		job.pks[i] = checkitem(L, -2, &pkln);
+		job.ms[i] = checkitem(L, -1, &job.mlns[i]);
+		if (sigln != 64) LERR("bad signature size");
+		if (pkln != 32) LERR("bad key size");
+		lua_pop(L, 4); // the triple stays referenced by the list
+	}
+	workpool_run(check_range, &job, nb, 0);
+	lua_createtable(L, nb, 0);
+	for (size_t i = 0; i < nb; i++) {
+		lua_pushboolean(L, job.ok[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+} // ln_check_many()
+
+static int ln_workpool(lua_State *L) {
+	// get or set the worker pool parameters
+	// Lua API: workpool([nthreads [, grain]]) return nthreads, grain
+	//  nthreads: optional number of worker threads. 0 disables the
+	//     threads. Default is the number of cpus minus one (the
+	//     calling thread also works)
+	//  grain: optional number of items processed by a thread at a
+	//     time (default 16). Jobs with less items than the grain
+	//     run in the calling thread
+	//  return the previous values
+	lua_Integer n = luaL_optinteger(L, 1, -1);
+	lua_Integer grain = luaL_optinteger(L, 2, 0);
+	if (n > 64) LERR("bad number of threads");
+	if (grain < 0) LERR("bad grain");
+	lua_pushinteger(L, workpool_threads(n));
+	lua_pushinteger(L, workpool_grain(grain));
+	return 2;
+} // ln_workpool()
+
+static int ln_threads_gc(lua_State *L) {
+	// stop the worker threads and the key pair pool thread
+	asyncpool_release();	// first: async jobs may use the others
+	workpool_release();
+	keypool_release();
+	randombytes_release();
+	return 0;
+}
+
+//----------------------------------------------------------------------
+// parallel authenticated encryption
+//
+// lock_parallel() splits the message in chunks of equal size (the
+// last one may be shorter) which are encrypted independently by the
+// worker pool. Encrypted text layout:
+//   header (16): text length (8) .. chunk size (4) .. chunk count (4)
+//   chunk i: mac (16) .. encrypted chunk
+// (integers are little endian). The chunks are encrypted with the
+// subkey HChacha20(k, n[0..16]) and the nonce n[16..24] .. i (8) .. 
+// 0*8. The header is the additional data of every chunk, so the 
+// chunk count and the text length cannot be changed, and the chunks
+// cannot be reordered or dropped.
+
+#define PAR_HEADER 16
+#define PAR_CHUNK 65536     	// default chunk size
+#define PAR_MIN_CHUNK 64
+
+typedef struct {
+	unsigned char key[32];  	// subkey
+	unsigned char inonce[8];	// n[16..24]
+	unsigned char header[PAR_HEADER];
+	size_t mln, chunk, count;
+	const unsigned char *in;
+	unsigned char *out;
+	unsigned char *ok;      	// decryption: one flag per chunk
+} par_job;
+
+static void store_le(unsigned char *p, uint64_t x, int n) {
+	for (int i = 0; i < n; i++) p[i] = (x >> (8*i)) & 0xff;
+}
+
+static uint64_t load_le(const unsigned char *p, int n) {
+	uint64_t x = 0;
+	for (int i = n - 1; i >= 0; i--) x = (x << 8) | p[i];
+	return x;
+}
+
+static void par_chunk(par_job *job, size_t i, size_t *mln, 
+		unsigned char nonce[24]) {
+	// length and nonce of chunk i
+	*mln = (i == job->count - 1) ? job->mln - i * job->chunk : job->chunk;
+	memcpy(nonce, job->inonce, 8);
+	store_le(nonce + 8, i, 8);
+	memset(nonce + 16, 0, 8);
+}
+
+static void lock_range(void *arg, size_t first, size_t last) {
+	par_job *job = arg;
+	unsigned char nonce[24];
+	size_t mln;
+	for (size_t i = first; i < last; i++) {
+		unsigned char *mac = job->out + PAR_HEADER + i * (job->chunk + 16);
+		par_chunk(job, i, &mln, nonce);
+		crypto_lock_aead(mac, mac + 16, job->key, nonce, 
+			job->header, PAR_HEADER, job->in + i * job->chunk, mln);
+	}
+}
+
+static void unlock_range(void *arg, size_t first, size_t last) {
+	par_job *job = arg;
+	unsigned char nonce[24];
+	size_t mln;
+	for (size_t i = first; i < last; i++) {
+		const unsigned char *mac = 
+			job->in + PAR_HEADER + i * (job->chunk + 16);
+		par_chunk(job, i, &mln, nonce);
+		job->ok[i] = (crypto_unlock_aead(job->out + i * job->chunk, 
+			job->key, nonce, mac, job->header, PAR_HEADER, 
+			mac + 16, mln) == 0);
+	}
+}
+
+static void par_init(par_job *job, const char *k, const char *n) {
+	crypto_chacha20_H(job->key, k, n);
+	memcpy(job->inonce, n + 16, 8);
+}
+
+static int ln_lock_parallel(lua_State *L) {
+	// Lua API: lock_parallel(k, n, m [, chunk]) => c
+	//  k: key string (32 bytes)
+	//  n: nonce string (24 bytes)
+	//	m: message (plain text) string 
+	//  chunk: optional chunk size in bytes (default 65536)
+	//  return the encrypted text string
+	//  (#c == 16 + #m + 16 * number of chunks)
+	size_t kln, nln;
+	par_job job;
+	const char *k = checkbytes(L,1,&kln);
+	const char *n = checkbytes(L,2,&nln);	
+	job.in = (const unsigned char *) checkbytes(L,3,&job.mln);	
+	lua_Integer chunk = luaL_optinteger(L, 4, PAR_CHUNK);
+	if (nln != 24) LERR("bad nonce size");
+	if (kln != 32) LERR("bad key size");
+	if ((chunk < PAR_MIN_CHUNK) || (chunk > 0x7fffffff)) {
+		LERR("bad chunk size");
+	}
+	job.chunk = chunk;
+	job.count = (job.mln == 0) ? 1 : (job.mln - 1) / job.chunk + 1;
+	if ((uint64_t) job.count > 0xffffffff) LERR("too many chunks");
+	store_le(job.header, job.mln, 8);
+	store_le(job.header + 8, job.chunk, 4);
+	store_le(job.header + 12, job.count, 4);
+	size_t cln = PAR_HEADER + job.mln + 16 * job.count;
+	luaL_Buffer b;
+	job.out = (unsigned char*) luaL_buffinitsize(L, &b, cln);
+	memcpy(job.out, job.header, PAR_HEADER);
+	par_init(&job, k, n);
+	workpool_run(lock_range, &job, job.count, 1);
+	crypto_wipe(job.key, 32);
+	luaL_pushresultsize(&b, cln);
+	return 1;
+} // ln_lock_parallel()
+
+static int ln_unlock_parallel(lua_State *L) {
+	// Lua API: unlock_parallel(k, n, c) => m
+	//  k: key string (32 bytes)
+	//  n: nonce string (24 bytes)
+	//	c: encrypted text string, as returned by lock_parallel()
+	//  return the plain text string or (nil, error msg) if any 
+	//  chunk is not valid
+	size_t kln, nln, cln;
+	par_job job;
+	const char *k = checkbytes(L,1,&kln);
+	const char *n = checkbytes(L,2,&nln);	
+	job.in = (const unsigned char *) checkbytes(L,3,&cln);	
+	if (nln != 24) LERR("bad nonce size");
+	if (kln != 32) LERR("bad key size");
+	if (cln < PAR_HEADER + 16) goto error;
+	memcpy(job.header, job.in, PAR_HEADER);
+	uint64_t mln = load_le(job.header, 8);
+	job.chunk = load_le(job.header + 8, 4);
+	job.count = load_le(job.header + 12, 4);
+	// the header must match the encrypted text size
+	if ((job.chunk < PAR_MIN_CHUNK) || (job.count == 0)
+		|| (mln != cln - PAR_HEADER - 16 * (uint64_t) job.count)
+		|| (job.count != ((mln == 0) ? 1 : (mln - 1) / job.chunk + 1))) {
+		goto error;
+	}
+	job.mln = mln;
+	// the scratch flags must be allocated before the Lua buffer
+	job.ok = lua_newuserdata(L, job.count);
+	luaL_Buffer b;
+	job.out = (unsigned char*) luaL_buffinitsize(L, &b, job.mln);
+	par_init(&job, k, n);
+	workpool_run(unlock_range, &job, job.count, 1);
+	crypto_wipe(job.key, 32);
+	for (size_t i = 0; i < job.count; i++) {
+		if (!job.ok[i]) {
+			crypto_wipe(job.out, job.mln); // partially decrypted
+			goto error;
+		}
+	}
+	luaL_pushresultsize(&b, job.mln);
+	return 1;
+error:
+	lua_pushnil (L);
+	lua_pushliteral(L, "unlock error");
+	return 2;         
+} // ln_unlock_parallel()
+
+//----------------------------------------------------------------------
+// seekable encrypted files
+//
+// The text is encrypted with a single XChacha20 stream, so the byte
+// at offset i of the text is at offset i of the encrypted data, and
+// any range can be decrypted after crypto_chacha20_set_ctr(). The
+// text is authenticated by blocks of a fixed size (a multiple of 64
+// bytes): the Poly1305 key of block i is taken from the same stream
+// at counter SEEK_MAC_CTR + i, far above the counters of the data.
+// The MAC of a block covers the file header, the block number and 
+// the encrypted block. File layout (integers are little endian):
+//   header (64):
+//     magic (8) .. block size (4) .. 0 (4) .. text length (8)
+//     .. nonce (24) .. 0 (16)
+//   encrypted text
+//   block index: MAC (16) of each block
+// A reader only reads, authenticates and decrypts the blocks which
+// cover the range which is read. The blocks and their MACs are read
+// into a private buffer, and decrypted from there: the file is not 
+// mapped, so a concurrent writer cannot change the text between its
+// authentication and its decryption (and a truncated file is a read 
+// error, not a SIGBUS).
+
+#define SEEKFILE_MT "luanacha.seekfile"
+#define SEEK_MAGIC "LNSEEK01"
+#define SEEK_HEADER 64
+#define SEEK_BLOCK 4096     	// default block size
+#define SEEK_MAC_CTR ((uint64_t) 1 << 63)
+
+typedef struct {
+	FILE *f;            	// NULL if closed
+	unsigned char header[SEEK_HEADER];
+	size_t bsize;       	// block size
+	uint64_t mln;       	// text length
+	crypto_chacha_ctx chacha;	// stream at counter 0
+} seekfile;
+
+#ifdef _WIN32
+#define seek_file(f, off) _fseeki64((f), (__int64) (off), SEEK_SET)
+#else
+#define seek_file(f, off) fseeko((f), (off_t) (off), SEEK_SET)
+#endif
+
+static int read_at(FILE *f, uint64_t off, unsigned char *buf, size_t n) {
+	// read n bytes at offset off. return 0, or -1
+	if (n == 0) return 0;
+	if (seek_file(f, off) != 0) return -1;
+	return (fread(buf, 1, n, f) == n) ? 0 : -1;
+}
+
+static void seek_mac(crypto_chacha_ctx *chacha, unsigned char mac[16],
+		const unsigned char *header, uint64_t i,
+		const unsigned char *c, size_t cln) {
+	// compute the MAC of block i (encrypted text c)
+	unsigned char key[64], num[8];
+	crypto_poly1305_ctx poly;
+	crypto_chacha20_set_ctr(chacha, SEEK_MAC_CTR + i);
+	crypto_chacha20_stream(chacha, key, 64);
+	store_le(num, i, 8);
+	crypto_poly1305_init(&poly, key);
+	crypto_poly1305_update(&poly, header, SEEK_HEADER);
+	crypto_poly1305_update(&poly, num, 8);
+	crypto_poly1305_update(&poly, c, cln);
+	crypto_poly1305_final(&poly, mac);
+	crypto_wipe(key, 64);
+}
+
+static int ln_seekfile_write(lua_State *L) {
+	// Lua API: seekfile_write(k, path, m [, bsize]) => true
+	//  k: key string (32 bytes)
+	//  path: file name. The file is replaced
+	//  m: the text to encrypt (string)
+	//  bsize: optional block size (a multiple of 64, default 4096)
+	//  return true, or (nil, error msg) if the file cannot be written
+	size_t kln, mln;
+	unsigned char header[SEEK_HEADER] = {0};
+	unsigned char cbuf[SEEK_BLOCK];
+	crypto_chacha_ctx chacha;
+	const char *k = checkbytes(L,1,&kln);
+	const char *path = luaL_checkstring(L, 2);
+	const unsigned char *m = (const unsigned char *) checkbytes(L,3,&mln);
+	lua_Integer bsize = luaL_optinteger(L, 4, SEEK_BLOCK);
+	if (kln != 32) LERR("bad key size");
+	if ((bsize < 64) || (bsize > (1 << 30)) || (bsize % 64 != 0)) {
+		LERR("bad block size");
+	}
+	size_t nb = (mln + bsize - 1) / bsize;
+	// the block index, and a larger block buffer if needed
+	unsigned char *macs = lua_newuserdata(L, nb * 16);
+	unsigned char *c = (bsize <= SEEK_BLOCK) ? cbuf : 
+		lua_newuserdata(L, bsize);
+	memcpy(header, SEEK_MAGIC, 8);
+	store_le(header + 8, bsize, 4);
+	store_le(header + 16, mln, 8);
+	if (randombytes(header + 24, 24) != 0) LERR("random generator error");
+	crypto_chacha20_x_init(&chacha, k, header + 24);
+	lua_pushfstring(L, "%s.tmp", path);
+	const char *tmp = lua_tostring(L, -1);
+	FILE *f = fopen(tmp, "wb");
+	int ok = (f != NULL) && (fwrite(header, 1, SEEK_HEADER, f) 
+		== SEEK_HEADER);
+	for (size_t i = 0; ok && (i < nb); i++) {
+		size_t cln = (i == nb - 1) ? mln - i * bsize : (size_t) bsize;
+		crypto_chacha20_set_ctr(&chacha, i * (bsize / 64));
+		crypto_chacha20_encrypt(&chacha, c, m + i * bsize, cln);
+		seek_mac(&chacha, macs + i * 16, header, i, c, cln);
+		ok = fwrite(c, 1, cln, f) == cln;
+	}
+	crypto_wipe(&chacha, sizeof(chacha));
+	ok = ok && (fwrite(macs, 16, nb, f) == nb);
+	if (f != NULL) ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+	if (ok) remove(path);	// rename() does not replace files
+#endif
+	if (!ok || (rename(tmp, path) != 0)) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", tmp, strerror(errno));
+		remove(tmp);
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+} // ln_seekfile_write()
+
+static void seekfile_close(seekfile *sf) {
+	if (sf->f == NULL) return;
+	fclose(sf->f);
+	sf->f = NULL;
+	crypto_wipe(&sf->chacha, sizeof(sf->chacha));
+}
+
+static int ln_seekfile(lua_State *L) {
+	// Lua API: seekfile(k, path) => sf
+	//  k: key string (32 bytes)
+	//  path: name of a file written by seekfile_write()
+	//  return sf, a seekable file object, or (nil, error msg)
+	size_t kln;
+	const char *k = checkbytes(L,1,&kln);
+	const char *path = luaL_checkstring(L, 2);
+	if (kln != 32) LERR("bad key size");
+	seekfile *sf = lua_newuserdata(L, sizeof(seekfile));
+	sf->f = NULL;
+	luaL_getmetatable(L, SEEKFILE_MT);
+	lua_setmetatable(L, -2);
+	sf->f = fopen(path, "rb");
+	if (sf->f == NULL) goto error;
+	setvbuf(sf->f, NULL, _IONBF, 0);	// blocks are read in the caller buffer
+	if (read_at(sf->f, 0, sf->header, SEEK_HEADER) != 0) {
+		seekfile_close(sf);
+		goto invalid;
+	}
+	sf->bsize = load_le(sf->header + 8, 4);
+	sf->mln = load_le(sf->header + 16, 8);
+	if ((memcmp(sf->header, SEEK_MAGIC, 8) != 0) || (sf->bsize < 64) 
+			|| (sf->bsize % 64 != 0) || (sf->mln > ((uint64_t) 1 << 60))) {
+		seekfile_close(sf);
+		goto invalid;
+	}
+	// the file size is checked here, but a file which is truncated
+	// later only makes the reads fail
+	uint64_t nb = (sf->mln + sf->bsize - 1) / sf->bsize;
+	unsigned char last;
+	if ((read_at(sf->f, SEEK_HEADER + sf->mln + nb * 16 - 1, &last, 1) 
+			!= 0) || (fread(&last, 1, 1, sf->f) != 0)) {
+		seekfile_close(sf);
+		goto invalid;
+	}
+	crypto_chacha20_x_init(&sf->chacha, k, sf->header + 24);
+	return 1;
+error:
+	lua_pushnil(L);
+	lua_pushfstring(L, "%s: %s", path, strerror(errno));
+	return 2;
+invalid:
+	lua_pushnil(L);
+	lua_pushfstring(L, "%s: not a seekable encrypted file", path);
+	return 2;
+} // ln_seekfile()
+
+static seekfile *check_seekfile(lua_State *L) {
+	seekfile *sf = luaL_checkudata(L, 1, SEEKFILE_MT);
+	if (sf->f == NULL) luaL_error(L, "file is closed");
+	return sf;
+}
+
+static int ln_seekfile_read(lua_State *L) {
+	// Lua API: sf:read(i, n) => s
+	//  i: offset in the text (0-based)
+	//  n: number of bytes to read (fewer at the end of the text)
+	//  return the decrypted bytes, or (nil, error msg) if a block 
+	//  which covers them is not authentic or cannot be read
+	seekfile *sf = check_seekfile(L);
+	lua_Integer i = luaL_checkinteger(L, 2);
+	lua_Integer n = luaL_checkinteger(L, 3);
+	if ((i < 0) || (n < 0)) LERR("bad range");
+	if ((uint64_t) i >= sf->mln) n = 0;
+	else if ((uint64_t) n > sf->mln - i) n = sf->mln - i;
+	// private copy of the blocks which cover [i, i+n) and their MACs
+	uint64_t first = i / sf->bsize;
+	uint64_t last = (n == 0) ? first : (i + n - 1) / sf->bsize + 1;
+	uint64_t start = first * sf->bsize;
+	size_t cln = (last * sf->bsize > sf->mln) ? 
+		sf->mln - start : (last - first) * sf->bsize;
+	if (n == 0) cln = 0;
+	unsigned char *c = lua_newuserdata(L, cln + (last - first) * 16);
+	unsigned char *macs = c + cln;
+	if ((read_at(sf->f, SEEK_HEADER + start, c, cln) != 0) ||
+		(read_at(sf->f, SEEK_HEADER + sf->mln + first * 16, macs, 
+			(last - first) * 16) != 0)) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "read error");
+		return 2;
+	}
+	crypto_chacha_ctx chacha = sf->chacha;
+	unsigned char mac[16], skip[64];
+	luaL_Buffer b;
+	unsigned char *m = (unsigned char*) luaL_buffinitsize(L, &b, n);
+	// authenticate the copied blocks
+	for (uint64_t j = first; j < last; j++) {
+		size_t off = (j - first) * sf->bsize;
+		size_t bln = (cln - off > sf->bsize) ? sf->bsize : cln - off;
+		seek_mac(&chacha, mac, sf->header, j, c + off, bln);
+		if (crypto_verify16(mac, macs + (j - first) * 16) != 0) {
+			crypto_wipe(&chacha, sizeof(chacha));
+			luaL_pushresultsize(&b, n); // (for the 5.1 shim)
+			lua_pushnil(L);
+			lua_pushliteral(L, "authentication error");
+			return 2;
+		}
+	}
+	// decrypt [i, i+n) from the copy
+	crypto_chacha20_set_ctr(&chacha, i / 64);
+	crypto_chacha20_stream(&chacha, skip, i % 64);
+	crypto_chacha20_encrypt(&chacha, m, c + (i - start), n);
+	crypto_wipe(&chacha, sizeof(chacha));
+	crypto_wipe(skip, 64);
+	luaL_pushresultsize(&b, n);
+	return 1;
+} // ln_seekfile_read()
+
+static int ln_seekfile_size(lua_State *L) {
+	// Lua API: sf:size() => length of the text
+	seekfile *sf = check_seekfile(L);
+	lua_pushinteger(L, sf->mln);
+	return 1;
+}
+
+static int ln_seekfile_close(lua_State *L) {
+	// Lua API: sf:close()
+	//  close the file. The object cannot be used again
+	seekfile *sf = luaL_checkudata(L, 1, SEEKFILE_MT);
+	seekfile_close(sf);
+	return 0;
+}
+
+static const struct luaL_Reg seekfile_methods[] = {
+	{"read", ln_seekfile_read},
+	{"size", ln_seekfile_size},
+	{"close", ln_seekfile_close},
+	{"__gc", ln_seekfile_close},
+	{NULL, NULL},
+};
+
+//----------------------------------------------------------------------
+// file signature and verification
+//
+// files are read in chunks of FILE_CHUNK bytes with a fixed buffer
+// (signature reads the file twice). The kernel is told that the file
+// is read sequentially, so it can read ahead. Files are not mapped in
+// memory: a mapped file truncated by another process would raise
+// SIGBUS in the Lua host.
+
+#define FILE_CHUNK (256 * 1024)
+
+typedef void (*update_fn)(void *ctx, const unsigned char *m, size_t mln);
+
+static FILE *file_open(lua_State *L, const char *path) {
+	// open a file for sequential reading. return NULL and push
+	// nil, error msg if the file cannot be opened
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", path, strerror(errno));
+		return NULL;
+	}
+	setvbuf(f, NULL, _IONBF, 0);	// read directly in the chunk buffer
+#if defined(POSIX_FADV_SEQUENTIAL)
+	posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	return f;
+}
+
+static int file_update(lua_State *L, FILE *f, const char *path,
+		unsigned char *buf, update_fn update, void *ctx) {
+	// feed the rest of f to update(). return 0, or -1 and push nil,
+	// error msg on read error
+	size_t n;
+	while ((n = fread(buf, 1, FILE_CHUNK, f)) > 0) update(ctx, buf, n);
+	if (!ferror(f)) return 0;
+	lua_pushnil(L);
+	lua_pushfstring(L, "%s: %s", path, strerror(errno));
+	return -1;
+}
+
+// the file is also hashed on each signature pass: if it changes 
+// between the passes, the nonce (first pass) and the challenge (second
+// pass) would be computed on different texts, and the signature would
+// leak the secret key to anyone who has a signature of the first text
+typedef struct {
+	crypto_sign_ctx sign;
+	crypto_blake2b_ctx hash;
+} sign_file_ctx;
+
+static void sign_update(void *ctx, const unsigned char *m, size_t mln) {
+	sign_file_ctx *sf = ctx;
+	crypto_sign_update(&sf->sign, m, mln);
+	crypto_blake2b_update(&sf->hash, m, mln);
+}
+
+static void check_update(void *ctx, const unsigned char *m, size_t mln) {
+	crypto_check_update(ctx, m, mln);
+}
+
+static int ln_sign_file(lua_State *L) {
+	// sign the content of a file with a signer
+	// Lua API: sign_file(s, path) return sig  or (nil, error msg)
+	//  s: a signer object
+	//  path: file name (string)
+	//  return the signature (a 64-byte string) or nil, error msg
+	//  if the file cannot be read, or if it is modified while it is
+	//  signed
+	sign_file_ctx ctx;
+	unsigned char sig[64], h1[64], h2[64];
+	crypto_sign_key *key = luaL_checkudata(L, 1, SIGNER_MT);
+	const char *path = luaL_checkstring(L, 2);
+	unsigned char *buf = lua_newuserdata(L, FILE_CHUNK);
+	FILE *f = file_open(L, path);
+	if (f == NULL) return 2;
+	crypto_sign_init_first_pass_key(&ctx.sign, key);
+	crypto_blake2b_init(&ctx.hash);
+	if (file_update(L, f, path, buf, sign_update, &ctx) != 0) goto error;
+	crypto_blake2b_final(&ctx.hash, h1);
+	crypto_sign_init_second_pass(&ctx.sign);
+	crypto_blake2b_init(&ctx.hash);
+	if (fseek(f, 0, SEEK_SET) != 0) { // a pipe cannot be read twice
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", path, strerror(errno));
+		goto error;
+	}
+	if (file_update(L, f, path, buf, sign_update, &ctx) != 0) goto error;
+	crypto_blake2b_final(&ctx.hash, h2);
+	if (memcmp(h1, h2, 64) != 0) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: file modified while signing", path);
+		goto error;
+	}
+	crypto_sign_final(&ctx.sign, sig);
+	fclose(f);
+	lua_pushlstring (L, sig, 64);
+	return 1;
+error:
+	crypto_wipe(&ctx, sizeof(ctx));
+	fclose(f);
+	return 2;
+} // ln_sign_file()
+
+static int ln_check_file(lua_State *L) {
+	// check the signature of the content of a file
+	// Lua API: check_file(sig, pk, path) return boolean
+	//           or (nil, error msg)
+	//  sig: signature string (64 bytes)
+	//  pk: public key string (32 bytes)
+	//  path: file name (string)
+	//  return true if the signature match, or false, or nil, error msg
+	//  if the file cannot be read
+	crypto_check_ctx ctx;
+	size_t pkln, sigln;
+	const char *sig = checkbytes(L,1,&sigln);
+	const char *pk = checkbytes(L,2,&pkln);
+	const char *path = luaL_checkstring(L, 3);
+	if (sigln != 64) LERR("bad signature size");
+	if (pkln != 32) LERR("bad key size");
+	unsigned char *buf = lua_newuserdata(L, FILE_CHUNK);
+	FILE *f = file_open(L, path);
+	if (f == NULL) return 2;
+	crypto_check_init(&ctx, sig, pk);
+	int r = file_update(L, f, path, buf, check_update, &ctx);
+	fclose(f);
+	if (r != 0) return 2;
+	lua_pushboolean (L, (crypto_check_final(&ctx) == 0));
+	return 1;
+} // ln_check_file()
+
+//----------------------------------------------------------------------
+// prehashed signatures
+//
+// the message is hashed once with blake2b (64-byte digest), then the
+// digest is signed with a domain separator (see crypto_sign_ph_with_key
+// in monocypher.c). Streams which cannot be read twice can be signed
+// and checked with the incremental sign_ph / check_ph objects.
+
+#define SIGN_PH_MT "luanacha.sign_ph"
+#define CHECK_PH_MT "luanacha.check_ph"
+
+typedef struct {
+	crypto_blake2b_ctx hash;
+	crypto_sign_key key;	// copy of the signer key
+	int done;           	// final() has been called
+} sign_ph_ctx;
+
+typedef struct {
+	crypto_blake2b_ctx hash;
+	unsigned char sig[64];
+	unsigned char pk[32];
+	int done;
+} check_ph_ctx;
+
+static void check_sig_pk(lua_State *L, int i,
+		const char **sig, const char **pk) {
+	// get a signature and a public key at index i and i+1
+	size_t sigln, pkln;
+	*sig = checkbytes(L, i, &sigln);
+	*pk = checkbytes(L, i + 1, &pkln);
+	if (sigln != 64) luaL_error(L, "bad signature size");
+	if (pkln != 32) luaL_error(L, "bad key size");
+}
+
+static int ln_sign_ph(lua_State *L) {
+	// sign the blake2b digest of a text
+	// Lua API: sign_ph(s, m) return sig
+	//  s: a signer object
+	//	m: message to sign (string)
+	//  return the prehashed signature (a 64-byte string)
+	size_t mln;
+	unsigned char dig[64], sig[64];
+	crypto_sign_key *key = luaL_checkudata(L, 1, SIGNER_MT);
+	const char *m = checkbytes(L,2,&mln);
+	crypto_blake2b(dig, m, mln);
+	crypto_sign_ph_with_key(sig, key, dig);
+	lua_pushlstring (L, sig, 64);
+	return 1;
+} // ln_sign_ph()
+
+static int ln_check_ph(lua_State *L) {
+	// check a prehashed signature
+	// Lua API: check_ph(sig, pk, m) return boolean
+	//  sig: signature string (64 bytes)
+	//  pk: public key string (32 bytes)
+	//	m: message to verify (string)
+	//  return true if the signature match, or false
+	size_t mln;
+	const char *sig, *pk;
+	unsigned char dig[64];
+	check_sig_pk(L, 1, &sig, &pk);
+	const char *m = checkbytes(L,3,&mln);
+	crypto_blake2b(dig, m, mln);
+	lua_pushboolean (L, (crypto_check_ph(sig, pk, dig) == 0));
+	return 1;
+} // ln_check_ph()
+
+static int ln_sign_ph_init(lua_State *L) {
+	// create a prehashed signature context
+	// Lua API: sign_ph_init(s) return ctx
+	//  s: a signer object
+	//  return ctx, with methods ctx:update(m) and ctx:final()
+	crypto_sign_key *key = luaL_checkudata(L, 1, SIGNER_MT);
+	sign_ph_ctx *ctx = lua_newuserdata(L, sizeof(sign_ph_ctx));
+	crypto_blake2b_init(&ctx->hash);
+	memcpy(&ctx->key, key, sizeof(crypto_sign_key));
+	ctx->done = 0;
+	luaL_getmetatable(L, SIGN_PH_MT);
+	lua_setmetatable(L, -2);
+	return 1;
+} // ln_sign_ph_init()
+
+static int ln_sign_ph_update(lua_State *L) {
+	// Lua API: ctx:update(m) return ctx
+	//	m: a message fragment (string)
+	size_t mln;
+	sign_ph_ctx *ctx = luaL_checkudata(L, 1, SIGN_PH_MT);
+	const char *m = checkbytes(L,2,&mln);
+	if (ctx->done) LERR("context already finalized");
+	crypto_blake2b_update(&ctx->hash, m, mln);
+	lua_settop(L, 1);
+	return 1;
+} // ln_sign_ph_update()
+
+static int ln_sign_ph_final(lua_State *L) {
+	// Lua API: ctx:final() return sig
+	//  return the prehashed signature of the concatenated fragments.
+	//  The signer key copy is wiped: the context cannot be used again
+	unsigned char dig[64], sig[64];
+	sign_ph_ctx *ctx = luaL_checkudata(L, 1, SIGN_PH_MT);
+	if (ctx->done) LERR("context already finalized");
+	crypto_blake2b_final(&ctx->hash, dig);
+	crypto_sign_ph_with_key(sig, &ctx->key, dig);
+	crypto_wipe(ctx, sizeof(sign_ph_ctx));
+	ctx->done = 1;
+	lua_pushlstring (L, sig, 64);
+	return 1;
+} // ln_sign_ph_final()
+
+static int ln_sign_ph_gc(lua_State *L) {
+	sign_ph_ctx *ctx = luaL_checkudata(L, 1, SIGN_PH_MT);
+	crypto_wipe(ctx, sizeof(sign_ph_ctx));
+	return 0;
+}
+
+static const struct luaL_Reg sign_ph_methods[] = {
+	{"update", ln_sign_ph_update},
+	{"final", ln_sign_ph_final},
+	{"__gc", ln_sign_ph_gc},
+	{NULL, NULL},
+};
+
+static int ln_check_ph_init(lua_State *L) {
+	// create a prehashed signature check context
+	// Lua API: check_ph_init(sig, pk) return ctx
+	//  sig: signature string (64 bytes)
+	//  pk: public key string (32 bytes)
+	//  return ctx, with methods ctx:update(m) and ctx:final()
+	const char *sig, *pk;
+	check_sig_pk(L, 1, &sig, &pk);
+	check_ph_ctx *ctx = lua_newuserdata(L, sizeof(check_ph_ctx));
+	crypto_blake2b_init(&ctx->hash);
+	memcpy(ctx->sig, sig, 64);
+	memcpy(ctx->pk, pk, 32);
+	ctx->done = 0;
+	luaL_getmetatable(L, CHECK_PH_MT);
+	lua_setmetatable(L, -2);
+	return 1;
+} // ln_check_ph_init()
+
+static int ln_check_ph_update(lua_State *L) {
+	// Lua API: ctx:update(m) return ctx
+	//	m: a message fragment (string)
+	size_t mln;
+	check_ph_ctx *ctx = luaL_checkudata(L, 1, CHECK_PH_MT);
+	const char *m = checkbytes(L,2,&mln);
+	if (ctx->done) LERR("context already finalized");
+	crypto_blake2b_update(&ctx->hash, m, mln);
+	lua_settop(L, 1);
+	return 1;
+} // ln_check_ph_update()
+
+static int ln_check_ph_final(lua_State *L) {
+	// Lua API: ctx:final() return boolean
+	//  return true if the signature matches the concatenated 
+	//  fragments, or false
+	unsigned char dig[64];
+	check_ph_ctx *ctx = luaL_checkudata(L, 1, CHECK_PH_MT);
+	if (ctx->done) LERR("context already finalized");
+	crypto_blake2b_final(&ctx->hash, dig);
+	ctx->done = 1;
+	lua_pushboolean (L, (crypto_check_ph(ctx->sig, ctx->pk, dig) == 0));
+	return 1;
+} // ln_check_ph_final()
+
+static const struct luaL_Reg check_ph_methods[] = {
+	{"update", ln_check_ph_update},
+	{"final", ln_check_ph_final},
+	{NULL, NULL},
+};
+
+//----------------------------------------------------------------------
+// check cache - a bounded cache of successful signature checks
+//
+// the cache holds 16-byte tags: keyed blake2b hashes of (sig, pk, m),
+// with a random hash key specific to each cache object, in a fixed
+// open addressing table. A tag is looked for in CHECK_CACHE_PROBES 
+// consecutive slots from its home slot. When they are all used, one
+// of them is replaced (in turn). Failed checks are never cached.
+
+#define CHECK_CACHE_MT "luanacha.check_cache"
+#define CHECK_CACHE_PROBES 8
+
+typedef struct {
+	unsigned char hkey[32];	// random key for the tags
+	size_t mask;        	// number of slots - 1 (a power of 2)
+	size_t count;       	// number of used slots
+	unsigned int evict; 	// next slot replaced in a full window
+	lua_Integer hits, misses;
+	unsigned char slots[][16];	// all zero if unused
+} check_cache;
+
+static const unsigned char check_cache_empty[16] = {0};
+
+static void check_cache_tag(check_cache *cc, unsigned char tag[16],
+		const char *sig, const char *pk, const char *m, size_t mln) {
+	crypto_blake2b_ctx ctx;
+	crypto_blake2b_general_init(&ctx, 16, cc->hkey, 32);
+	crypto_blake2b_update(&ctx, sig, 64);
+	crypto_blake2b_update(&ctx, pk, 32);
+	crypto_blake2b_update(&ctx, m, mln);
+	crypto_blake2b_final(&ctx, tag);
+}
+
+static unsigned char *check_cache_find(check_cache *cc, 
+		const unsigned char tag[16], int *found) {
+	// return the slot holding tag (*found = 1), or the slot where
+	// tag should be inserted (*found = 0)
+	size_t home;
+	memcpy(&home, tag, sizeof(home)); // tags are uniformly distributed
+	for (int i = 0; i < CHECK_CACHE_PROBES; i++) {
+		unsigned char *slot = cc->slots[(home + i) & cc->mask];
+		if (memcmp(slot, tag, 16) == 0) {
+			*found = 1;
+			return slot;
+		}
+		if (memcmp(slot, check_cache_empty, 16) == 0) {
+			// tags are never removed: tag is not further
+			*found = 0;
+			return slot;
+		}
+	}
+	*found = 0;
+	return cc->slots[(home + cc->evict++ % CHECK_CACHE_PROBES) & cc->mask];
+}
+
+static int ln_check_cache(lua_State *L) {
+	// create a check cache
+	// lua api:  check_cache([n]) => cc
+	// n: number of slots (rounded up to a power of 2). Default is 4096.
+	//    Each slot takes 16 bytes.
+	// return cc, a check cache object
+	lua_Integer n = luaL_optinteger(L, 1, 4096);
+	if ((n < 1) || (n > (1 << 24))) LERR("bad cache size");
+	size_t nslots = CHECK_CACHE_PROBES;
+	while (nslots < (size_t) n) nslots *= 2;
+	check_cache *cc = lua_newuserdata(L, sizeof(check_cache) + nslots * 16);
+	memset(cc, 0, sizeof(check_cache) + nslots * 16);
+	cc->mask = nslots - 1;
+	luaL_getmetatable(L, CHECK_CACHE_MT);
+	lua_setmetatable(L, -2);
+	if (randombytes(cc->hkey, 32) != 0) LERR("random generator error");
+	return 1;
+}// ln_check_cache()
+
+static int ln_check_cache_check(lua_State *L) {
+	// check a text signature through the cache
+	// lua api:  cc:check(sig, pk, m) => boolean
+	// same as check(sig, pk, m), but the signature is not checked again
+	// if the same (sig, pk, m) has been successfully checked recently
+	size_t mln;
+	const char *sig, *pk;
+	unsigned char tag[16];
+	int found;
+	check_cache *cc = luaL_checkudata(L, 1, CHECK_CACHE_MT);
+	check_sig_pk(L, 2, &sig, &pk);
+	const char *m = checkbytes(L,4,&mln);
+	check_cache_tag(cc, tag, sig, pk, m, mln);
+	unsigned char *slot = check_cache_find(cc, tag, &found);
+	if (found) {
+		cc->hits++;
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+	cc->misses++;
+	int ok = (crypto_check(sig, pk, m, mln) == 0);
+	if (ok) {
+		if (memcmp(slot, check_cache_empty, 16) == 0) cc->count++;
+		memcpy(slot, tag, 16);
+	}
+	lua_pushboolean(L, ok);
+	return 1;
+}// ln_check_cache_check()
+
+static int ln_check_cache_stats(lua_State *L) {
+	// lua api:  cc:stats() => hits, misses, count
+	// hits, misses: number of checks found / not found in the cache
+	// count: number of entries currently in the cache
+	check_cache *cc = luaL_checkudata(L, 1, CHECK_CACHE_MT);
+	lua_pushinteger(L, cc->hits);
+	lua_pushinteger(L, cc->misses);
+	lua_pushinteger(L, cc->count);
+	return 3;
+}// ln_check_cache_stats()
+
+static int ln_check_cache_clear(lua_State *L) {
+	// lua api:  cc:clear()
+	// remove all the entries (the stats are kept)
+	check_cache *cc = luaL_checkudata(L, 1, CHECK_CACHE_MT);
+	memset(cc->slots, 0, (cc->mask + 1) * 16);
+	cc->count = 0;
+	return 0;
+}// ln_check_cache_clear()
+
+static const struct luaL_Reg check_cache_methods[] = {
+	{"check", ln_check_cache_check},
+	{"stats", ln_check_cache_stats},
+	{"clear", ln_check_cache_clear},
+	{NULL, NULL},
+};
+
 //------------------------------------------------------------
 // argon2i password derivation
 //
 
 static int ln_argon2i(lua_State *L) {
-	// Lua API: argon2i(pw, salt, nkb, niters) => k
+	// Lua API: argon2i(pw, salt, nkb, niters [, askey]) => k
 	// pw: the password string
 	// salt: some entropy as a string (typically 16 bytes)
 	// nkb:  number of kilobytes used in RAM (as large as possible)
 	// niters: number of iterations (as large as possible, >= 10)
+	// askey: if true, k is returned as a key handle
 	//  return k, a key string (32 bytes)
 	size_t pwln, saltln, kln, mln;
-	const char *pw = luaL_checklstring(L,1,&pwln);
-	const char *salt = luaL_checklstring(L,2,&saltln);	
+	const char *pw = checkbytes(L,1,&pwln);
+	const char *salt = checkbytes(L,2,&saltln);	
 	int nkb = luaL_checkinteger(L,3);	
 	int niters = luaL_checkinteger(L,4);	
-	unsigned char k[32];
-	size_t worksize = nkb * 1024;
+	int askey = lua_toboolean(L, 5);
+	if (nkb < 8) LERR("bad number of kilobytes");
+	if (niters < 1) LERR("bad number of iterations");
+	luaL_Buffer b;
+	unsigned char *k = askey ? new_key(L) : 
+		(unsigned char*) luaL_buffinitsize(L, &b, 32);
+	size_t worksize = (size_t)nkb * 1024;
 	unsigned char *work= malloc(worksize);
+	if (work == NULL) LERR("not enough memory");
 	crypto_argon2i_general(	k, 32, work, nkb, niters,
 					pw, pwln, salt, saltln, 
 					"", 0, "", 0 	// optional key and additional data
 					);
-
-	lua_pushlstring (L, k, 32); 
+	crypto_wipe(work, worksize);
 	free(work);
+	if (!askey) luaL_pushresultsize(&b, 32); 
 	return 1;
 } // ln_argon2i()
 
+//----------------------------------------------------------------------
+// asynchronous jobs
+//
+// async() runs a library function in a native thread (see 
+// asyncpool.c) and returns at once a future, which holds the results
+// when the job is done. Completions are signaled on a file descriptor
+// which an event loop can poll (async_fd()).
+//
+// The worker threads never use the caller's Lua state: the arguments
+// are copied when the job is submitted, and each worker thread calls
+// the functions in a private Lua state. The results are copied back
+// when they are collected by f:result(). Strings, buffers, numbers,
+// booleans, nil and tables of these are copied (buffers are copied as
+// strings). Key handles are copied into new key handles, so that keys
+// stay out of the Lua heap.
+
+typedef struct async_job {
+	struct async_job *next;
+	void (*run)(struct async_job *job, void **local);
+	void (*free)(struct async_job *job);
+	int state;
+	int abandoned;
+	long pid;
+} async_job;
+
+extern int asyncpool_submit(async_job *job);
+extern int asyncpool_done(async_job *job);
+extern int asyncpool_wait(async_job *job);
+extern void asyncpool_abandon(async_job *job);
+extern int asyncpool_fd(void);
+extern long asyncpool_ack(void);
+extern int asyncpool_threads(int n);
+extern void asyncpool_cleanup(void (*cleanup)(void *local));
+
+#define FUTURE_MT "luanacha.future"
+#define PACK_MAX_DEPTH 16
+
+// a list of values, copied out of a Lua state
+typedef struct {
+	unsigned char *p;
+	size_t len, size;
+	int count;  	// number of values
+} packbuf;
+
+typedef struct {
+	async_job base;
+	lua_CFunction fn;
+	int failed; 	// 1 if fn raised an error (res is the message)
+	packbuf args, res;
+} call_job;
+
+typedef struct {
+	call_job *job;
+} future;
+
+// defined with the library declaration
+static lua_CFunction find_function(const char *name);
+static void new_classes(lua_State *L);
+
+// the functions which can be called by async(): functions of their 
+// arguments only. Functions which use or change process-wide state 
+// (caches, the key pools, the key arena, the worker pool threads) are
+// not in the list. (randombytes() uses the generator of the async 
+// thread. Key handles passed as arguments or returned are copied in 
+// new key arena slots: the arena is protected by a mutex)
+static const char *const async_functions[] = {
+	"randombytes",
+	"lock", "unlock", "lock_aead", "unlock_aead",
+	"lock_many", "unlock_many",
+	"seekfile_write",
+	"x25519_public_key", "public_key",
+	"key_exchange", "dh_key",
+	"blake2b",
+	"sign_public_key", "sign", "check", "check_batch",
+	"check_file", "check_ph",
+	"argon2i",
+	NULL,
+};
+
+static lua_CFunction find_async_function(const char *name) {
+	// return the library function called name if it can be called 
+	// by async(), or NULL
+	for (const char *const *p = async_functions; *p != NULL; p++) {
+		if (strcmp(*p, name) == 0) return find_function(name);
+	}
+	return NULL;
+}
+
+static int pack_bytes(packbuf *pb, int tag, const void *s, size_t ln) {
+	// append a tag and ln bytes. return 0, or -1 if out of memory
+	if (pb->size - pb->len < ln + 1) {
+		size_t size = pb->size + (pb->size >> 1) + ln + 64;
+		unsigned char *p = malloc(size);
+		if (p == NULL) return -1;
+		if (pb->p != NULL) {
+			memcpy(p, pb->p, pb->len);
+			crypto_wipe(pb->p, pb->size);
+			free(pb->p);
+		}
+		pb->p = p;
+		pb->size = size;
+	}
+	pb->p[pb->len++] = tag;
+	if (ln > 0) memcpy(pb->p + pb->len, s, ln);
+	pb->len += ln;
+	return 0;
+}
+
+static const char *pack_value(lua_State *L, int i, packbuf *pb, 
+		int depth) {
+	// append the value at index i. return NULL, or an error message
+	int r = 0;
+	switch (lua_type(L, i)) {
+	case LUA_TNIL:
+		r = pack_bytes(pb, 'n', NULL, 0);
+		break;
+	case LUA_TBOOLEAN: {
+		unsigned char b = lua_toboolean(L, i);
+		r = pack_bytes(pb, 'b', &b, 1);
+		break;
+	}
+	case LUA_TNUMBER: {
+#if (LUA_VERSION_NUM >= 503)
+		if (lua_isinteger(L, i)) {
+			lua_Integer n = lua_tointeger(L, i);
+			r = pack_bytes(pb, 'i', &n, sizeof(n));
+			break;
+		}
+#endif
+		lua_Number d = lua_tonumber(L, i);
+		r = pack_bytes(pb, 'd', &d, sizeof(d));
+		break;
+	}
+	case LUA_TSTRING:
+	case LUA_TUSERDATA: {
+		size_t ln;
+		keyhandle *kh = toudata(L, i, KEY_MT);
+		const char *s = tobytes(L, i, &ln);
+		if (s == NULL) return "unsupported type";
+		if (kh != NULL) {
+			r = pack_bytes(pb, 'k', s, 32);
+		} else {
+			r = pack_bytes(pb, 's', &ln, sizeof(ln)) ||
+				pack_bytes(pb, '.', s, ln);
+		}
+		break;
+	}
+	case LUA_TTABLE: {
+		const char *msg;
+		if (depth >= PACK_MAX_DEPTH) return "table too deep";
+		if (i < 0) i = lua_gettop(L) + i + 1;
+		luaL_checkstack(L, 3, "table too deep");
+		if ((r = pack_bytes(pb, 't', NULL, 0)) != 0) break;
+		lua_pushnil(L);
+		while (lua_next(L, i) != 0) {
+			if ((msg = pack_value(L, -2, pb, depth + 1)) != NULL ||
+				(msg = pack_value(L, -1, pb, depth + 1)) != NULL) {
+				lua_pop(L, 2);
+				return msg;
+			}
+			lua_pop(L, 1);
+		}
+		r = pack_bytes(pb, 'e', NULL, 0);
+		break;
+	}
+	default:
+		return "unsupported type";
+	}
+	return (r == 0) ? NULL : "not enough memory";
+}
+
+static void pack_values(lua_State *L, int first, int last, packbuf *pb,
+		const char *what) {
+	// append the values at indices first..last (or raise an error)
+	for (int i = first; i <= last; i++) {
+		const char *msg = pack_value(L, i, pb, 0);
+		if (msg != NULL) luaL_error(L, "%s %d: %s", what, i, msg);
+		pb->count++;
+	}
+}
+
+static void unpack_value(lua_State *L, const unsigned char **pp) {
+	// push the value at *pp, and move *pp after it
+	const unsigned char *p = *pp;
+	luaL_checkstack(L, 3, "table too deep");
+	switch (*p++) {
+	case 'n': lua_pushnil(L); break;
+	case 'b': lua_pushboolean(L, *p++); break;
+	case 'i': {
+		lua_Integer n;
+		memcpy(&n, p, sizeof(n));
+		p += sizeof(n);
+		lua_pushinteger(L, n);
+		break;
+	}
+	case 'd': {
+		lua_Number d;
+		memcpy(&d, p, sizeof(d));
+		p += sizeof(d);
+		lua_pushnumber(L, d);
+		break;
+	}
+	case 's': {
+		size_t ln;
+		memcpy(&ln, p, sizeof(ln));
+		p += sizeof(ln) + 1; // skip the '.' tag of the bytes
+		lua_pushlstring(L, (const char *) p, ln);
+		p += ln;
+		break;
+	}
+	case 'k':
+		memcpy(new_key(L), p, 32);
+		p += 32;
+		break;
+	case 't':
+		lua_newtable(L);
+		while (*p != 'e') {
+			unpack_value(L, &p);
+			unpack_value(L, &p);
+			lua_rawset(L, -3);
+		}
+		p++;
+		break;
+	}
+	*pp = p;
+}
+
+static int unpack_values(lua_State *L, packbuf *pb) {
+	// push all the values. return their number
+	const unsigned char *p = pb->p;
+	luaL_checkstack(L, pb->count, "too many values");
+	for (int i = 0; i < pb->count; i++) unpack_value(L, &p);
+	return pb->count;
+}
+
+static void free_packbuf(packbuf *pb) {
+	if (pb->p != NULL) {
+		crypto_wipe(pb->p, pb->size); // may contain keys
+		free(pb->p);
+	}
+	pb->p = NULL;
+	pb->len = pb->size = 0;
+	pb->count = 0;
+}
+
+static void free_call_job(async_job *aj) {
+	call_job *job = (call_job *) aj;
+	free_packbuf(&job->args);
+	free_packbuf(&job->res);
+	free(job);
+}
+
+static int call_protected(lua_State *L) {
+	// (in a worker thread) call the job function in the worker Lua
+	// state, and copy its results
+	call_job *job = lua_touserdata(L, 1);
+	lua_settop(L, 0);
+	lua_pushcfunction(L, job->fn);
+	unpack_values(L, &job->args);
+	lua_call(L, job->args.count, LUA_MULTRET);
+	pack_values(L, 1, lua_gettop(L), &job->res, "result");
+	return 0;
+}
+
+static int open_worker_state(lua_State *L) {
+	new_classes(L);
+	return 0;
+}
+
+static void run_call_job(async_job *aj, void **local) {
+	// (in a worker thread) the Lua state is created for the first job
+	// of the thread, and closed when the thread stops
+	call_job *job = (call_job *) aj;
+	lua_State *L = *local;
+	const char *msg = "not enough memory";
+	if (L == NULL) {
+		L = luaL_newstate();
+		if ((L != NULL) && (lua_pushcfunction(L, open_worker_state), 
+				lua_pcall(L, 0, 0, 0) != 0)) {
+			lua_close(L);
+			L = NULL;
+		}
+		*local = L;
+	}
+	if (L != NULL) {
+		lua_pushcfunction(L, call_protected);
+		lua_pushlightuserdata(L, job);
+		if (lua_pcall(L, 1, 0, 0) == 0) msg = NULL;
+		else if (lua_isstring(L, -1)) msg = lua_tostring(L, -1);
+		else msg = "error in async job";
+	}
+	if (msg != NULL) {
+		size_t ln = strlen(msg);
+		job->failed = 1;
+		free_packbuf(&job->res);
+		if ((pack_bytes(&job->res, 's', &ln, sizeof(ln)) == 0) &&
+			(pack_bytes(&job->res, '.', msg, ln) == 0)) {
+			job->res.count = 1;
+		}
+	}
+	if (L != NULL) lua_settop(L, 0);
+	free_packbuf(&job->args);
+}
+
+static void close_worker_state(void *local) {
+	lua_close((lua_State *) local);
+}
+
+static int ln_async(lua_State *L) {
+	// Lua API: async(name, ...) => f
+	//  name: name of a library function (eg. "argon2i", see 
+	//     async_functions above)
+	//  ...: the function arguments
+	//  return f, a future. The function is called in a worker thread.
+	//  f:result() returns its results.
+	const char *name = luaL_checkstring(L, 1);
+	lua_CFunction fn = find_async_function(name);
+	if (fn == NULL) LERR("unknown or not asynchronous function");
+	// the future is created first: the job is freed when it is 
+	// collected, even if an argument cannot be copied
+	future *f = lua_newuserdata(L, sizeof(future));
+	f->job = NULL;
+	luaL_getmetatable(L, FUTURE_MT);
+	lua_setmetatable(L, -2);
+	call_job *job = calloc(1, sizeof(call_job));
+	if (job == NULL) LERR("not enough memory");
+	job->base.free = free_call_job;
+	f->job = job;
+	job->base.run = run_call_job;
+	job->fn = fn;
+	pack_values(L, 2, lua_gettop(L) - 1, &job->args, "argument");
+	if (asyncpool_submit(&job->base) != 0) {
+		LERR("cannot start the async threads");
+	}
+	return 1;
+} // ln_async()
+
+static future *checkfuture(lua_State *L, int i) {
+	future *f = luaL_checkudata(L, i, FUTURE_MT);
+	if (f->job == NULL) luaL_error(L, "future has been collected");
+	return f;
+}
+
+static int ln_future_done(lua_State *L) {
+	// Lua API: f:done() => boolean
+	//  return true if the job is done (f:result() will not block)
+	future *f = checkfuture(L, 1);
+	lua_pushboolean(L, asyncpool_done(&f->job->base));
+	return 1;
+}
+
+static int ln_future_result(lua_State *L) {
+	// Lua API: f:result() => ...
+	//  wait until the job is done, and return the results of the
+	//  function. If the function raised an error, the error is
+	//  raised again. (can be called several times)
+	//  Raise an error if the job was submitted before a fork() and
+	//  was not done at the fork (it is never run in the child)
+	future *f = checkfuture(L, 1);
+	if (asyncpool_wait(&f->job->base) != 0) {
+		LERR("job submitted before fork() not done");
+	}
+	lua_settop(L, 1);
+	int n = unpack_values(L, &f->job->res);
+	if (f->job->failed) lua_error(L);
+	return n;
+}
+
+static int ln_future_gc(lua_State *L) {
+	// the job is freed now, or by its worker thread when it is done
+	future *f = luaL_checkudata(L, 1, FUTURE_MT);
+	if (f->job != NULL) asyncpool_abandon(&f->job->base);
+	f->job = NULL;
+	return 0;
+}
+
+static const struct luaL_Reg future_methods[] = {
+	{"done", ln_future_done},
+	{"result", ln_future_result},
+	{"__gc", ln_future_gc},
+	{NULL, NULL},
+};
+
+static int ln_async_fd(lua_State *L) {
+	// Lua API: async_fd() => fd
+	//  return the number of a file descriptor which is readable when
+	//  async jobs are done (to be polled by an event loop), or nil if
+	//  it is not available. async_ack() clears it.
+	int fd = asyncpool_fd();
+	if (fd < 0) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "no async file descriptor");
+		return 2;
+	}
+	lua_pushinteger(L, fd);
+	return 1;
+}
+
+static int ln_async_ack(lua_State *L) {
+	// Lua API: async_ack() => n
+	//  clear the async file descriptor. return the number of jobs
+	//  done since the previous call
+	lua_pushinteger(L, asyncpool_ack());
+	return 1;
+}
+
+static int ln_async_threads(lua_State *L) {
+	// Lua API: async_threads([n]) => previous n
+	//  n: optional number of async worker threads (1 to 64). Default
+	//     is the number of cpus minus one, and at least 1
+	lua_Integer n = luaL_optinteger(L, 1, -1);
+	if ((n == 0) || (n > 64)) LERR("bad number of threads");
+	lua_pushinteger(L, asyncpool_threads(n));
+	return 1;
+}
+
 //------------------------------------------------------------
 // lua library declaration
 //
@@ -447,6 +3805,23 @@ static const struct luaL_Reg luanachalib[] = {
 	//
 	{"lock", ln_lock},
 	{"unlock", ln_unlock},
+	{"lock_aead", ln_lock_aead},
+	{"unlock_aead", ln_unlock_aead},
+	{"lock_into", ln_lock_into},
+	{"unlock_into", ln_unlock_into},
+	{"lock_many", ln_lock_many},
+	{"unlock_many", ln_unlock_many},
+	{"nonce_sequence", ln_nonce_sequence},
+	{"lock_auto", ln_lock_auto},
+	{"buffer", ln_buffer},
+	{"key", ln_key},
+	{"key_arena", ln_key_arena},
+	{"encryptor", ln_encryptor},
+	{"decryptor", ln_decryptor},
+	{"lock_parallel", ln_lock_parallel},
+	{"unlock_parallel", ln_unlock_parallel},
+	{"seekfile_write", ln_seekfile_write},
+	{"seekfile", ln_seekfile},
 	//
 	{"x25519_keypair", ln_x25519_keypair},
 	{"x25519_public_key", ln_x25519_public_key},
@@ -454,6 +3829,8 @@ static const struct luaL_Reg luanachalib[] = {
 	{"public_key", ln_x25519_public_key},  // alias
 	{"key_exchange", ln_key_exchange},
 	{"dh_key", ln_key_exchange},           // alias
+	{"key_cache", ln_key_cache},
+	{"keypair_pool", ln_keypair_pool},
 	//
 	{"blake2b", ln_blake2b},
 	{"blake2b_init", ln_blake2b_init},
@@ -463,14 +3840,86 @@ static const struct luaL_Reg luanachalib[] = {
 	{"sign_keypair", ln_sign_keypair},
 	{"sign_public_key", ln_sign_public_key},	
 	{"sign", ln_sign},	
+	{"signer", ln_signer},
 	{"check", ln_check},	
+	{"check_batch", ln_check_batch},
+	{"verifier", ln_verifier},
+	{"verifier_cache", ln_verifier_cache},
+	{"check_cache", ln_check_cache},
+	{"keystore", ln_keystore},
+	{"keystore_build", ln_keystore_build},
+	{"sign_many", ln_sign_many},
+	{"check_many", ln_check_many},
+	{"workpool", ln_workpool},
+	{"sign_file", ln_sign_file},
+	{"check_file", ln_check_file},
+	{"sign_ph", ln_sign_ph},
+	{"check_ph", ln_check_ph},
+	{"sign_ph_init", ln_sign_ph_init},
+	{"check_ph_init", ln_check_ph_init},
 	//
 	{"argon2i", ln_argon2i},	
 	//
+	{"async", ln_async},
+	{"async_fd", ln_async_fd},
+	{"async_ack", ln_async_ack},
+	{"async_threads", ln_async_threads},
+	//
 	{NULL, NULL},
 };
 
+static lua_CFunction find_function(const char *name) {
+	// return the library function called name, or NULL
+	for (const struct luaL_Reg *r = luanachalib; r->name != NULL; r++) {
+		if (strcmp(r->name, name) == 0) return r->func;
+	}
+	return NULL;
+}
+
+// create the metatable for a userdata type. The metatable is its own
+// __index table, so methods and metamethods are declared together
+#define NEWCLASS(L, name, methods) { \
+	luaL_newmetatable(L, name); \
+	lua_pushvalue(L, -1); \
+	lua_setfield(L, -2, "__index"); \
+	luaL_register(L, NULL, methods); \
+	lua_pop(L, 1); }
+
+static void new_classes(lua_State *L) {
+	// (also used for the Lua states of the async worker threads)
+	NEWCLASS(L, BUFFER_MT, buffer_methods);
+	NEWCLASS(L, KEY_MT, key_methods);
+	NEWCLASS(L, NONCE_SEQ_MT, nonce_seq_methods);
+	NEWCLASS(L, ENCRYPTOR_MT, encryptor_methods);
+	NEWCLASS(L, DECRYPTOR_MT, decryptor_methods);
+	NEWCLASS(L, SEEKFILE_MT, seekfile_methods);
+	NEWCLASS(L, KEY_CACHE_MT, key_cache_methods);
+	NEWCLASS(L, VERIFIER_MT, verifier_methods);
+	NEWCLASS(L, KEYSTORE_MT, keystore_methods);
+	NEWCLASS(L, CHECK_CACHE_MT, check_cache_methods);
+	NEWCLASS(L, SIGNER_MT, signer_methods);
+	NEWCLASS(L, SIGN_PH_MT, sign_ph_methods);
+	NEWCLASS(L, CHECK_PH_MT, check_ph_methods);
+	NEWCLASS(L, FUTURE_MT, future_methods);
+}
+
 int luaopen_luanacha(lua_State *L) {
+	new_classes(L);
+	// the worker threads (and async threads) and the key pair pool 
+	// thread are stopped 
+	// when the last Lua state using the library is closed (before the
+	// library is unloaded)
+	workpool_retain();
+	keypool_retain();
+	randombytes_retain();
+	asyncpool_retain();
+	asyncpool_cleanup(close_worker_state);
+	lua_newuserdata(L, 1);
+	luaL_newmetatable(L, THREADS_MT);
+	lua_pushcfunction(L, ln_threads_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_setmetatable(L, -2);
+	lua_setfield(L, LUA_REGISTRYINDEX, THREADS_MT);
 	luaL_register (L, "luanacha", luanachalib);
     // 
     lua_pushliteral (L, "VERSION");
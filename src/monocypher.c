@@ -67,6 +67,15 @@ static void store64_le(u8 out[8], u64 in)
     store32_le(out + 4, in >> 32);
 }
 
+static void load32_le_buf(u32 *dst, const u8 *src, size_t size)
+{
+    FOR (i, 0, size) { dst[i] = load32_le(src + i*4); }
+}
+static void store32_le_buf(u8 *dst, const u32 *src, size_t size)
+{
+    FOR (i, 0, size) { store32_le(dst + i*4, src[i]); }
+}
+
 static u64 rotr64(u64 x, u64 n) { return (x >> n) ^ (x << (64 - n)); }
 static u32 rotl32(u32 x, u32 n) { return (x << n) ^ (x >> (32 - n)); }
 
@@ -1342,56 +1351,102 @@ int crypto_x25519(u8       raw_shared_secret[32],
     return -1 - zerocmp32(raw_shared_secret);
 }
 
-void crypto_x25519_public_key(u8       public_key[32],
-                              const u8 secret_key[32])
-{
-    static const u8 base_point[32] = {9};
-    crypto_x25519(public_key, secret_key, base_point);
-}
+// crypto_x25519_public_key() is defined with the Ed25519 functions,
+// it uses the fixed base scalar multiplication.
 
 ///////////////
 /// Ed25519 ///
 ///////////////
 
-static const  u64 L[32] = { 0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
-                            0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
-                            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10};
+// Scalars modulo L are handled with 32 bit limbs, little endian.
+static const u32 L[8] = { 0x5cf5d3ed, 0x5812631a, 0xa2f79cd6, 0x14def9de,
+                          0x00000000, 0x00000000, 0x00000000, 0x10000000 };
 
-static void modL(u8 *r, i64 x[64])
+// p = a*b + p
+static void multiply(u32 p[16], const u32 a[8], const u32 b[8])
 {
-    for (unsigned i = 63; i >= 32; i--) {
-        i64 carry = 0;
-        FOR (j, i-32, i-12) {
-            x[j] += carry - 16 * x[i] * L[j - (i - 32)];
-            carry = (x[j] + 128) >> 8;
-            x[j] -= carry * (1 << 8);
+    FOR (i, 0, 8) {
+        u64 carry = 0;
+        FOR (j, 0, 8) {
+            carry  += p[i+j] + (u64)a[i] * b[j];
+            p[i+j]  = (u32)carry;
+            carry >>= 32;
         }
-        x[i-12] += carry;
-        x[i] = 0;
+        p[i+8] = (u32)carry;
     }
-    i64 carry = 0;
-    FOR (i, 0, 32) {
-        x[i] += carry - (x[31] >> 4) * L[i];
-        carry = x[i] >> 8;
-        x[i] &= 255;
+}
+
+// Returns 1 if x >= L, 0 otherwise (constant time).
+// Adds -L (~L + 1) and looks at the final carry.
+static int is_above_l(const u32 x[8])
+{
+    u64 carry = 1;
+    FOR (i, 0, 8) {
+        carry  += (u64)x[i] + (~L[i] & 0xffffffff);
+        carry >>= 32;
     }
-    FOR (i, 0, 32) {
-        x[i] -= carry * L[i];
+    return (int)carry;
+}
+
+// r = x mod L, for x < 2*L (conditional subtraction)
+static void remove_l(u32 r[8], const u32 x[8])
+{
+    u64 carry = (u64)is_above_l(x);
+    u32 mask  = ~(u32)carry + 1; // carry is 0 or 1
+    FOR (i, 0, 8) {
+        carry += (u64)x[i] + (~L[i] & mask);
+        r[i]   = (u32)carry;
+        carry >>= 32;
     }
-    FOR (i, 0, 32) {
-        x[i+1] += x[i] >> 8;
-        r[i  ]  = x[i] & 255;
+}
+
+// Barrett reduction of a 512 bit number modulo L.
+// m = floor(2^512 / L), q = floor(x * m / 2^512) is at most 1 below
+// floor(x / L), so x - q*L < 2*L.
+static void modL(u8 r[32], const u32 x[16])
+{
+    static const u32 m[9] = { 0x0a2c131b, 0xed9ce5a3, 0x086329a7,
+                              0x2106215d, 0xffffffeb, 0xffffffff,
+                              0xffffffff, 0xffffffff, 0x0000000f };
+    // xm = x * m
+    u32 xm[25] = {0};
+    FOR (i, 0, 9) {
+        u64 carry = 0;
+        FOR (j, 0, 16) {
+            carry  += xm[i+j] + (u64)m[i] * x[j];
+            xm[i+j] = (u32)carry;
+            carry >>= 32;
+        }
+        xm[i+16] = (u32)carry;
     }
+    // xm = q * L, with q = xm[16..24].  The result is below 2*L,
+    // so only the low 256 bits are needed.
+    FOR (i, 0, 8) { xm[i] = 0; }
+    FOR (i, 0, 8) {
+        u64 carry = 0;
+        FOR (j, 0, 8-i) {
+            carry   += xm[i+j] + (u64)xm[i+16] * L[j];
+            xm[i+j]  = (u32)carry;
+            carry  >>= 32;
+        }
+    }
+    // xm = x - q*L
+    u64 carry = 1;
+    FOR (i, 0, 8) {
+        carry  += (u64)x[i] + (~xm[i] & 0xffffffff);
+        xm[i]   = (u32)carry;
+        carry >>= 32;
+    }
+    remove_l(xm, xm);
+    store32_le_buf(r, xm, 8);
+    WIPE_BUFFER(xm);
 }
 
 static void reduce(u8 r[64])
 {
-    i64 x[64];
-    FOR (i, 0, 64) {
-        x[i] = (u64) r[i];
-        r[i] = 0;
-    }
+    u32 x[16];
+    load32_le_buf(x, r, 16);
+    FOR (i, 32, 64) { r[i] = 0; }
     modL(r, x);
     WIPE_BUFFER(x);
 }
@@ -1399,25 +1454,22 @@ static void reduce(u8 r[64])
 // r = (a * b) + c
 static void mul_add(u8 r[32], const u8 a[32], const u8 b[32], const u8 c[32])
 {
-    i64 s[64];
-    FOR (i,  0, 32) { s[i] = (u64) c[i]; }
-    FOR (i, 32, 64) { s[i] = 0;          }
-    FOR (i,  0, 32) {
-        FOR (j, 0, 32) {
-            s[i+j] += a[i] * (u64) b[j];
-        }
-    }
-    modL(r, s);
-    WIPE_BUFFER(s);
+    u32 A[8];  load32_le_buf(A, a, 8);
+    u32 B[8];  load32_le_buf(B, b, 8);
+    u32 p[16]; load32_le_buf(p, c, 8);
+    FOR (i, 8, 16) { p[i] = 0; }
+    multiply(p, A, B);
+    modL(r, p);
+    WIPE_BUFFER(p);
+    WIPE_BUFFER(A);
+    WIPE_BUFFER(B);
 }
 
 static int is_above_L(const u8 a[32])
 {
-    for (int i = 31; i >= 0; i--) {
-        if (a[i] > L[i]) { return 1; }
-        if (a[i] < L[i]) { return 0; }
-    }
-    return 1;
+    u32 x[8];
+    load32_le_buf(x, a, 8);
+    return is_above_l(x);
 }
 
 // Point in a twisted Edwards curve,
@@ -1434,20 +1486,27 @@ static void ge_zero(ge *p)
     fe_0(p->T);
 }
 
-static void ge_tobytes(u8 s[32], const ge *h)
+// recip = 1/Z, computed by the caller
+static void ge_tobytes_recip(u8 s[32], const ge *h, const fe recip)
 {
-    fe recip, x, y;
-    fe_invert(recip, h->Z);
+    fe x, y;
     fe_mul(x, h->X, recip);
     fe_mul(y, h->Y, recip);
     fe_tobytes(s, y);
     s[31] ^= fe_isnegative(x) << 7;
 
-    WIPE_BUFFER(recip);
     WIPE_BUFFER(x);
     WIPE_BUFFER(y);
 }
 
+static void ge_tobytes(u8 s[32], const ge *h)
+{
+    fe recip;
+    fe_invert(recip, h->Z);
+    ge_tobytes_recip(s, h, recip);
+    WIPE_BUFFER(recip);
+}
+
 // Variable time! s must not be secret!
 static int ge_frombytes_neg_vartime(ge *h, const u8 s[32])
 {
@@ -1577,28 +1636,48 @@ static void ge_double(ge *s, const ge *p, ge *q)
     fe_mul(s->T, q->X , q->T);
 }
 
-// Compute signed sliding windows (either 0, or odd numbers between -15 and 15)
-static void slide(i8 adds[258], const u8 scalar[32])
+// Fixed base tables, in Niels coordinates (Z=1): each entry is
+// Y+X (10 limbs), Y-X (10 limbs), and 2*d*X*Y (10 limbs).
+// - base_table[i][j] = (j+1) * 256^i * B (30 KiB), for
+//   ge_scalarmult_base().
+// - base_wnaf[i] = (2*i + 1) * B (7.5 KiB), for the 8-bit sliding
+//   windows of signature verification.
+// The tables are generated at build time by tools/gen_tables.c, which
+// uses the arithmetic above.
+#ifndef MONOCYPHER_NO_TABLES
+#include "monocypher_tables.h"
+#else // placeholders for the generator
+static const i32 base_table[32][8][30];
+static const i32 base_wnaf[64][30];
+#endif
+
+// Compute signed sliding windows of width bits (either 0, or odd numbers
+// between -(2^(width-1) - 1) and 2^(width-1) - 1).
+// scalar must be below 2^253.
+static void slide(i8 adds[258], const u8 scalar[32], int width)
 {
     FOR (i,   0, 256) { adds[i] = scalar_bit(scalar, i); }
     FOR (i, 256, 258) { adds[i] = 0;                     }
+    int half = 1 << (width - 1);
     FOR (i, 0, 254) {
         if (adds[i] != 0) {
-            // base value of the 5-bit window
-            FOR (j, 1, 5) {
-                adds[i  ] |= adds[i+j] << j;
-                adds[i+j]  = 0;
+            // base value of the window
+            int add = 1;
+            for (size_t j = 1; j < (size_t)width && i + j < 256; j++) {
+                add      |= adds[i+j] << j;
+                adds[i+j] = 0;
             }
-            if (adds[i] > 16) {
-                // go back to [-15, 15], propagate carry.
-                adds[i] -= 32;
-                int j = i + 5;
+            if (add > half) {
+                // go back to [-half+1, half-1], propagate carry.
+                add -= half * 2;
+                size_t j = i + width;
                 while (adds[j] != 0) {
                     adds[j] = 0;
                     j++;
                 }
                 adds[j] = 1;
             }
+            adds[i] = (i8)add;
         }
     }
 }
@@ -1620,25 +1699,31 @@ static void ge_precompute(ge_cached lut[8], const ge *P1)
     if (adds[i] > 0) { ge_add(sum, sum, &lut[ adds[i] / 2]); } \
     if (adds[i] < 0) { ge_sub(sum, sum, &lut[-adds[i] / 2]); }
 
+// Adds the odd multiple of the base point given by a sliding window
+// (see base_wnaf[])
+static void ge_madd_wnaf(ge *sum, int add, fe a, fe b)
+{
+    if (add > 0) {
+        const i32 *e = base_wnaf[add / 2];
+        ge_madd(sum, sum, e, e + 10, e + 20, a, b);
+    }
+    if (add < 0) {
+        const i32 *e = base_wnaf[-add / 2];
+        fe n2;
+        fe_neg(n2, e + 20);
+        ge_madd(sum, sum, e + 10, e, n2, a, b);
+    }
+}
+
 // Variable time! P, sP, and sB must not be secret!
-static void ge_double_scalarmult_vartime(ge *sum, const ge *P,
+// cP is the look up table of P (see ge_precompute())
+static void ge_double_scalarmult_vartime(ge *sum, const ge_cached cP[8],
                                          u8 p[32], u8 b[32])
 {
-    static const fe X = { -14297830, -7645148, 16144683, -16471763, 27570974,
-                          -2696100, -26142465, 8378389, 20764389, 8758491 };
-    static const fe Y = { -26843541, -6710886, 13421773, -13421773, 26843546,
-                          6710886, -13421773, 13421773, -26843546, -6710886 };
-    ge B;
-    fe_copy(B.X, X);
-    fe_copy(B.Y, Y);
-    fe_1   (B.Z);
-    fe_mul (B.T, X, Y);
-
-    // cached points for addition
-    ge_cached cP[8];  ge_precompute(cP,  P);
-    ge_cached cB[8];  ge_precompute(cB, &B);
-    i8 p_adds[258];   slide(p_adds, p);
-    i8 b_adds[258];   slide(b_adds, b);
+    ge tmp;
+    fe ta, tb; // temporaries for ge_madd_wnaf()
+    i8 p_adds[258];   slide(p_adds, p, 5);
+    i8 b_adds[258];   slide(b_adds, b, 8);
 
     // Avoid the first doublings
     int i = 253;
@@ -1651,174 +1736,79 @@ static void ge_double_scalarmult_vartime(ge *sum, const ge *P,
     // Merged double and add ladder
     ge_zero(sum);
     LUT_ADD(sum, cP, p_adds, i);
-    LUT_ADD(sum, cB, b_adds, i);
+    ge_madd_wnaf(sum, b_adds[i], ta, tb);
     i--;
     while (i >= 0) {
-        ge_double(sum, sum, &B); // B is no longer used, we can overwrite it
+        ge_double(sum, sum, &tmp);
         LUT_ADD(sum, cP, p_adds, i);
-        LUT_ADD(sum, cB, b_adds, i);
+        ge_madd_wnaf(sum, b_adds[i], ta, tb);
         i--;
     }
 }
 
-// 5-bit signed comb in cached format (Niels coordinates, Z=1)
-static const fe comb_Yp[16] = {
-    {2615675, 9989699, 17617367, -13953520, -8802803,
-     1447286, -8909978, -270892, -12199203, -11617247},
-    {-1271192, 4785266, -29856067, -6036322, -10435381,
-     15493337, 20321440, -6036064, 15902131, 13420909},
-    {-26170888, -12891603, 9568996, -6197816, 26424622,
-     16308973, -4518568, -3771275, -15522557, 3991142},
-    {-25875044, 1958396, 19442242, -9809943, -26099408,
-     -18589, -30794750, -14100910, 4971028, -10535388},
-    {-13896937, -7357727, -12131124, 617289, -33188817,
-     10080542, 6402555, 10779157, 1176712, 2472642},
-    {71503, 12662254, -17008072, -8370006, 23408384,
-     -12897959, 32287612, 11241906, -16724175, 15336924},
-    {27397666, 4059848, 23573959, 8868915, -10602416,
-     -10456346, -22812831, -9666299, 31810345, -2695469},
-    {-3418193, -694531, 2320482, -11850408, -1981947,
-     -9606132, 23743894, 3933038, -25004889, -4478918},
-    {-4448372, 5537982, -4805580, 14016777, 15544316,
-     16039459, -7143453, -8003716, -21904564, 8443777},
-    {32495180, 15749868, 2195406, -15542321, -3213890,
-     -4030779, -2915317, 12751449, -1872493, 11926798},
-    {26779741, 12553580, -24344000, -4071926, -19447556,
-     -13464636, 21989468, 7826656, -17344881, 10055954},
-    {5848288, -1639207, -10452929, -11760637, 6484174,
-     -5895268, -11561603, 587105, -19220796, 14378222},
-    {32050187, 12536702, 9206308, -10016828, -13333241,
-     -4276403, -24225594, 14562479, -31803624, -9967812},
-    {23536033, -6219361, 199701, 4574817, 30045793,
-     7163081, -2244033, 883497, 10960746, -14779481},
-    {-8143354, -11558749, 15772067, 14293390, 5914956,
-     -16702904, -7410985, 7536196, 6155087, 16571424},
-    {6211591, -11166015, 24568352, 2768318, -10822221,
-     11922793, 33211827, 3852290, -13160369, -8855385},
-};
-static const fe comb_Ym[16] = {
-    {8873912, 14981221, 13714139, 6923085, 25481101,
-     4243739, 4646647, -203847, 9015725, -16205935},
-    {-1827892, 15407265, 2351140, -11810728, 28403158,
-     -1487103, -15057287, -4656433, -3780118, -1145998},
-    {-30623162, -11845055, -11327147, -16008347, 17564978,
-     -1449578, -20580262, 14113978, 29643661, 15580734},
-    {-15109423, 13348938, -14756006, 14132355, 30481360,
-     1830723, -240510, 9371801, -13907882, 8024264},
-    {25119567, 5628696, 10185251, -9279452, 683770,
-     -14523112, -7982879, -16450545, 1431333, -13253541},
-    {-8390493, 1276691, 19008763, -12736675, -9249429,
-     -12526388, 17434195, -13761261, 18962694, -1227728},
-    {26361856, -12366343, 8941415, 15163068, 7069802,
-     -7240693, -18656349, 8167008, 31106064, -1670658},
-    {-5677136, -11012483, -1246680, -6422709, 14772010,
-     1829629, -11724154, -15914279, -18177362, 1301444},
-    {937094, 12383516, -22597284, 7580462, -18767748,
-     13813292, -2323566, 13503298, 11510849, -10561992},
-    {28028043, 14715827, -6558532, -1773240, 27563607,
-     -9374554, 3201863, 8865591, -16953001, 7659464},
-    {13628467, 5701368, 4674031, 11935670, 11461401,
-     10699118, 31846435, -114971, -8269924, -14777505},
-    {-22124018, -12859127, 11966893, 1617732, 30972446,
-     -14350095, -21822286, 8369862, -29443219, -15378798},
-    {290131, -471434, 8840522, -2654851, 25963762,
-     -11578288, -7227978, 13847103, 30641797, 6003514},
-    {-23547482, -11475166, -11913550, 9374455, 22813401,
-     -5707910, 26635288, 9199956, 20574690, 2061147},
-    {9715324, 7036821, -17981446, -11505533, 26555178,
-     -3571571, 5697062, -14128022, 2795223, 9694380},
-    {14864569, -6319076, -3080, -8151104, 4994948,
-     -1572144, -41927, 9269803, 13881712, -13439497},
-};
-static const fe comb_T2[16] = {
-    {-18494317, 2686822, 18449263, -13905325, 5966562,
-     -3368714, 2738304, -8583315, 15987143, 12180258},
-    {-33336513, -13705917, -18473364, -5039204, -4268481,
-     -4136039, -8192211, -2935105, -19354402, 5995895},
-    {-19753139, -1729018, 21880604, 13471713, 28315373,
-     -8530159, -17492688, 11730577, -8790216, 3942124},
-    {17278020, 3905045, 29577748, 11151940, 18451761,
-     -6801382, 31480073, -13819665, 26308905, 10868496},
-    {26937294, 3313561, 28601532, -3497112, -22814130,
-     11073654, 8956359, -16757370, 13465868, 16623983},
-    {-5468054, 6059101, -31275300, 2469124, 26532937,
-     8152142, 6423741, -11427054, -15537747, -10938247},
-    {-11303505, -9659620, -12354748, -9331434, 19501116,
-     -9146390, -841918, -5315657, 8903828, 8839982},
-    {16603354, -215859, 1591180, 3775832, -705596,
-     -13913449, 26574704, 14963118, 19649719, 6562441},
-    {33188866, -12232360, -24929148, -6133828, 21818432,
-     11040754, -3041582, -3524558, -29364727, -10264096},
-    {-20704194, -12560423, -1235774, -785473, 13240395,
-     4831780, -472624, -3796899, 25480903, -15422283},
-    {-2204347, -16313180, -21388048, 7520851, -8697745,
-     -14460961, 20894017, 12210317, -475249, -2319102},
-    {-16407882, 4940236, -21194947, 10781753, 22248400,
-     14425368, 14866511, -7552907, 12148703, -7885797},
-    {16376744, 15908865, -30663553, 4663134, -30882819,
-     -10105163, 19294784, -10800440, -33259252, 2563437},
-    {30208741, 11594088, -15145888, 15073872, 5279309,
-     -9651774, 8273234, 4796404, -31270809, -13316433},
-    {-17802574, 14455251, 27149077, -7832700, -29163160,
-     -7246767, 17498491, -4216079, 31788733, -14027536},
-    {-25233439, -9389070, -6618212, -3268087, -521386,
-     -7350198, 21035059, -14970947, 25910190, 11122681},
-};
+// Constant time selection of b * 256^i * B, with b in [-8, 8].
+// The selection reads all the entries of the row, and is written as
+// a single masked loop over 30 limbs so compilers can vectorise it.
+static void base_select(i32 t[30], int i, i8 b)
+{
+    u8  neg  = (u8)b >> 7;                   // 1 if b < 0
+    u8  babs = b - (((-neg) & b) * 2);       // |b|
+    FOR (k,  0, 30) { t[k] = 0; }
+    t[0] = 1;                                // Y+X = 1
+    t[10] = 1;                               // Y-X = 1, T2 = 0
+    FOR (j, 0, 8) {
+        i32 mask = -(i32)(1 & ((u32)((babs ^ (j + 1)) - 1) >> 8));
+        const i32 *e = base_table[i][j];
+        FOR (k, 0, 30) {
+            t[k] ^= (t[k] ^ e[k]) & mask;
+        }
+    }
+    // -P: swap Y+X and Y-X, negate T2
+    fe n2;
+    fe_neg   (n2, t + 20);
+    fe_cswap (t, t + 10, neg);
+    fe_ccopy (t + 20, n2, neg);
+    WIPE_BUFFER(n2);
+}
 
+// Radix 16 fixed base scalar multiplication (from Supercop's ref10).
+// scalar must be below 2^255.
 static void ge_scalarmult_base(ge *p, const u8 scalar[32])
 {
-    // 5-bits signed comb, from Mike Hamburg's
-    // Fast and compact elliptic-curve cryptography (2012)
-    static const u8 half_mod_L[32] = { // 1 / 2 modulo L
-        0xf7, 0xe9, 0x7a, 0x2e, 0x8d, 0x31, 0x09, 0x2c,
-        0x6b, 0xce, 0x7b, 0x51, 0xef, 0x7c, 0x6f, 0x0a,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08,
-    };
-    static const u8 half_ones[32] = { // (2^255 - 1) / 2 modulo L
-        0x42, 0x9a, 0xa3, 0xba, 0x23, 0xa5, 0xbf, 0xcb,
-        0x11, 0x5b, 0x9d, 0xc5, 0x74, 0x95, 0xf3, 0xb6,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x07,
-    };
-    // All bits set form: 1 means 1, 0 means -1
-    u8 s_scalar[32];
-    mul_add(s_scalar, scalar, half_mod_L, half_ones);
+    // signed radix 16 digits, between -8 and 8
+    i8 e[64];
+    FOR (i, 0, 32) {
+        e[2*i    ] = scalar[i]       & 15;
+        e[2*i + 1] = (scalar[i] >> 4) & 15;
+    }
+    i8 carry = 0;
+    FOR (i, 0, 63) {
+        e[i] += carry;
+        carry = (e[i] + 8) >> 4;
+        e[i] -= carry * 16;
+    }
+    e[63] += carry;
 
-    // Double and add ladder
-    fe yp, ym, t2, n2, a, b; // temporaries for addition
-    ge dbl;                  // temporary for doublings
+    i32 t[30];  // selected point
+    fe  a, b;   // temporaries for addition
+    ge  dbl;    // temporary for doublings
+    // odd digits, then multiply by 16, then even digits
     ge_zero(p);
-    for (int i = 50; i >= 0; i--) {
-        if (i < 50) {
-            ge_double(p, p, &dbl);
-        }
-        fe_1(yp);
-        fe_1(ym);
-        fe_0(t2);
-        u8 teeth =  scalar_bit(s_scalar, i)
-            +      (scalar_bit(s_scalar, i +  51) << 1)
-            +      (scalar_bit(s_scalar, i + 102) << 2)
-            +      (scalar_bit(s_scalar, i + 153) << 3)
-            +      (scalar_bit(s_scalar, i + 204) << 4);
-        u8 high  = teeth >> 4;
-        u8 index = (teeth ^ (high - 1)) & 15;
-        FOR (j, 0, 16) {
-            i32 select = 1 & (((j ^ index) - 1) >> 8);
-            fe_ccopy(yp, comb_Yp[j], select);
-            fe_ccopy(ym, comb_Ym[j], select);
-            fe_ccopy(t2, comb_T2[j], select);
-        }
-
-        fe_neg(n2, t2);
-        fe_cswap(t2, n2, high);
-        fe_cswap(yp, ym, high);
-        ge_madd(p, p, ym, yp, n2, a, b);
+    for (int i = 1; i < 64; i += 2) {
+        base_select(t, i / 2, e[i]);
+        ge_madd(p, p, t, t + 10, t + 20, a, b);
+    }
+    ge_double(p, p, &dbl);
+    ge_double(p, p, &dbl);
+    ge_double(p, p, &dbl);
+    ge_double(p, p, &dbl);
+    for (int i = 0; i < 64; i += 2) {
+        base_select(t, i / 2, e[i]);
+        ge_madd(p, p, t, t + 10, t + 20, a, b);
     }
     WIPE_CTX(&dbl);
-    WIPE_BUFFER(a);  WIPE_BUFFER(yp);  WIPE_BUFFER(t2);
-    WIPE_BUFFER(b);  WIPE_BUFFER(ym);  WIPE_BUFFER(n2);
-    WIPE_BUFFER(s_scalar);
+    WIPE_BUFFER(a);  WIPE_BUFFER(t);
+    WIPE_BUFFER(b);  WIPE_BUFFER(e);
 }
 
 void crypto_sign_public_key(u8       public_key[32],
@@ -1834,6 +1824,29 @@ void crypto_sign_public_key(u8       public_key[32],
     WIPE_CTX(&A);
 }
 
+// Same as crypto_x25519(public_key, secret_key, base_point), with the
+// fixed base table: the scalar multiplication is done on the twisted
+// Edwards curve, then mapped to the Montgomery curve (u = (1+y)/(1-y))
+void crypto_x25519_public_key(u8       public_key[32],
+                              const u8 secret_key[32])
+{
+    u8 e[32];
+    FOR (i, 0, 32) {
+        e[i] = secret_key[i];
+    }
+    trim_scalar(e);
+    ge A;
+    ge_scalarmult_base(&A, e);
+    fe t1, t2;
+    fe_add(t1, A.Z, A.Y);
+    fe_sub(t2, A.Z, A.Y);
+    fe_invert(t2, t2);
+    fe_mul(t1, t1, t2);
+    fe_tobytes(public_key, t1);
+    WIPE_BUFFER(e);   WIPE_CTX(&A);
+    WIPE_BUFFER(t1);  WIPE_BUFFER(t2);
+}
+
 void crypto_sign_init_first_pass(crypto_sign_ctx *ctx,
                                  const u8  secret_key[32],
                                  const u8  public_key[32])
@@ -1859,6 +1872,113 @@ void crypto_sign_init_first_pass(crypto_sign_ctx *ctx,
     HASH_UPDATE(&ctx->hash, prefix , 32);
 }
 
+void crypto_sign_key_init(crypto_sign_key *key, const u8 secret_key[32])
+{
+    u8 a[64];
+    HASH(a, secret_key, 32);
+    trim_scalar(a);
+    FOR (i, 0, 32) {
+        key->a     [i] = a[i     ];
+        key->prefix[i] = a[i + 32];
+    }
+    ge A;
+    ge_scalarmult_base(&A, key->a);
+    ge_tobytes(key->pk, &A);
+    WIPE_BUFFER(a);
+    WIPE_CTX(&A);
+}
+
+void crypto_sign_init_first_pass_key(crypto_sign_ctx       *ctx,
+                                     const crypto_sign_key *key)
+{
+    u8 *a      = ctx->buf;
+    u8 *prefix = ctx->buf + 32;
+    FOR (i, 0, 32) {
+        a      [i] = key->a     [i];
+        prefix [i] = key->prefix[i];
+        ctx->pk[i] = key->pk    [i];
+    }
+    HASH_INIT  (&ctx->hash);
+    HASH_UPDATE(&ctx->hash, prefix , 32);
+}
+
+void crypto_sign_with_key(u8                     signature[64],
+                          const crypto_sign_key *key,
+                          const u8 *message, size_t message_size)
+{
+    crypto_sign_ctx ctx;
+    crypto_sign_init_first_pass_key(&ctx, key);
+    crypto_sign_update             (&ctx, message, message_size);
+    crypto_sign_init_second_pass   (&ctx);
+    crypto_sign_update             (&ctx, message, message_size);
+    crypto_sign_final              (&ctx, signature);
+}
+
+// Signs up to SIGN_LANES messages with the same key, step by step:
+// the nonces, the nonce points, then the challenges.  The nonce
+// points share a single field inversion (Montgomery's trick): the
+// inverse of Z0*Z1*...*Zn gives every 1/Zi with 3 multiplications.
+#define SIGN_LANES 8
+static void sign_lanes(u8 *signatures, const crypto_sign_key *key,
+                       const u8 *messages[], const size_t message_sizes[],
+                       size_t nb)
+{
+    HASH_CTX hash;
+    u8 r    [SIGN_LANES][64];
+    u8 h_ram[64];
+    ge R    [SIGN_LANES];
+    fe acc  [SIGN_LANES]; // acc[i] = Z0 * ... * Zi
+    fe inv, recip;
+    FOR (i, 0, nb) {
+        HASH_INIT  (&hash);
+        HASH_UPDATE(&hash, key->prefix, 32);
+        HASH_UPDATE(&hash, messages[i], message_sizes[i]);
+        HASH_FINAL (&hash, r[i]);
+        reduce(r[i]);
+        ge_scalarmult_base(&R[i], r[i]);
+    }
+    fe_copy(acc[0], R[0].Z);
+    FOR (i, 1, nb) {
+        fe_mul(acc[i], acc[i-1], R[i].Z);
+    }
+    fe_invert(inv, acc[nb-1]);           // inv = 1 / (Z0 * ... * Zn)
+    for (size_t i = nb - 1; i > 0; i--) {
+        fe_mul(recip, inv, acc[i-1]);    // recip = 1 / Zi
+        fe_mul(inv  , inv, R[i].Z);      // inv   = 1 / (Z0 * ... * Zi-1)
+        ge_tobytes_recip(signatures + i*64, &R[i], recip);
+    }
+    ge_tobytes_recip(signatures, &R[0], inv);
+    FOR (i, 0, nb) {
+        u8 *sig = signatures + i*64;
+        HASH_INIT  (&hash);
+        HASH_UPDATE(&hash, sig        , 32);
+        HASH_UPDATE(&hash, key->pk    , 32);
+        HASH_UPDATE(&hash, messages[i], message_sizes[i]);
+        HASH_FINAL (&hash, h_ram);
+        reduce(h_ram);
+        mul_add(sig + 32, h_ram, key->a, r[i]); // s = h_ram * a + r
+    }
+    WIPE_CTX(&hash);
+    WIPE_BUFFER(r);
+    WIPE_BUFFER(R);
+    WIPE_BUFFER(acc);
+    WIPE_BUFFER(inv);
+    WIPE_BUFFER(recip);
+}
+
+void crypto_sign_many_with_key(u8                    *signatures,
+                               const crypto_sign_key *key,
+                               const u8              *messages[],
+                               const size_t           message_sizes[],
+                               size_t                 nb)
+{
+    for (size_t i = 0; i < nb; i += SIGN_LANES) {
+        size_t n = nb - i < SIGN_LANES ? nb - i : SIGN_LANES;
+        sign_lanes(signatures + i*64, key, messages + i, message_sizes + i,
+                   n);
+    }
+}
+
 void crypto_sign_update(crypto_sign_ctx *ctx, const u8 *msg, size_t msg_size)
 {
     HASH_UPDATE(&ctx->hash, msg, msg_size);
@@ -1929,24 +2049,35 @@ void crypto_check_update(crypto_check_ctx *ctx, const u8 *msg, size_t msg_size)
     HASH_UPDATE(&ctx->hash, msg , msg_size);
 }
 
-int crypto_check_final(crypto_check_ctx *ctx)
+// lut is the look up table of -A (the negated public key)
+static int check_final(crypto_check_ctx *ctx, const ge_cached lut[8])
 {
-    ge diff, A;
+    ge diff;
     u8 h_ram[64], R_check[32];
     u8 *s = ctx->sig + 32;                       // s
     u8 *R = ctx->sig;                            // R
-    if (ge_frombytes_neg_vartime(&A, ctx->pk) ||
-        is_above_L(s)) { // prevent s malleability
+    if (is_above_L(s)) { // prevent s malleability
         return -1;
     }
     HASH_FINAL(&ctx->hash, h_ram);
     reduce(h_ram);
-    ge_double_scalarmult_vartime(&diff, &A, h_ram, s);
+    ge_double_scalarmult_vartime(&diff, lut, h_ram, s);
     ge_tobytes(R_check, &diff);                  // R_check = s*B - h_ram*A
     return crypto_verify32(R, R_check);          // R == R_check ? OK : fail
     // No secret, no wipe
 }
 
+int crypto_check_final(crypto_check_ctx *ctx)
+{
+    ge A;
+    ge_cached lut[8];
+    if (ge_frombytes_neg_vartime(&A, ctx->pk)) {
+        return -1;
+    }
+    ge_precompute(lut, &A);
+    return check_final(ctx, lut);
+}
+
 int crypto_check(const u8  signature[64],
                  const u8  public_key[32],
                  const u8 *message, size_t message_size)
@@ -1957,6 +2088,259 @@ int crypto_check(const u8  signature[64],
     return crypto_check_final(&ctx);
 }
 
+int crypto_check_key_init(crypto_check_key *key, const u8 public_key[32])
+{
+    ge A;
+    if (ge_frombytes_neg_vartime(&A, public_key)) {
+        return -1;
+    }
+    ge_precompute((ge_cached*)key->lut, &A);
+    FOR (i, 0, 32) {
+        key->pk[i] = public_key[i];
+    }
+    return 0;
+}
+
+int crypto_check_final_key(crypto_check_ctx *ctx, const crypto_check_key *key)
+{
+    return check_final(ctx, (const ge_cached*)key->lut);
+}
+
+int crypto_check_with_key(const u8  signature[64],
+                          const crypto_check_key *key,
+                          const u8 *message, size_t message_size)
+{
+    crypto_check_ctx ctx;
+    crypto_check_init(&ctx, signature, key->pk);
+    crypto_check_update(&ctx, message, message_size);
+    return crypto_check_final_key(&ctx, key);
+}
+
+// Prehashed signatures.  As in Ed25519ph (RFC 8032), the dom2 prefix
+// (with phflag = 1 and an empty context) is hashed before the nonce
+// and before R || A || digest, so a prehashed signature cannot be
+// confused with a signature made by crypto_sign().
+static const u8 ph_dom[34] = "SigEd25519 no Ed25519 collisions\x01";
+
+void crypto_sign_ph_with_key(u8                     signature[64],
+                             const crypto_sign_key *key,
+                             const u8               digest[64])
+{
+    HASH_CTX hash;
+    u8 r[64], h_ram[64];
+    HASH_INIT  (&hash);
+    HASH_UPDATE(&hash, ph_dom     , 34);
+    HASH_UPDATE(&hash, key->prefix, 32);
+    HASH_UPDATE(&hash, digest     , 64);
+    HASH_FINAL (&hash, r);
+    reduce(r);
+
+    ge R;
+    ge_scalarmult_base(&R, r);
+    ge_tobytes(signature, &R);
+    WIPE_CTX(&R);
+
+    HASH_INIT  (&hash);
+    HASH_UPDATE(&hash, ph_dom   , 34);
+    HASH_UPDATE(&hash, signature, 32);
+    HASH_UPDATE(&hash, key->pk  , 32);
+    HASH_UPDATE(&hash, digest   , 64);
+    HASH_FINAL (&hash, h_ram);
+    reduce(h_ram);
+    mul_add(signature + 32, h_ram, key->a, r); // s = h_ram * a + r
+    WIPE_BUFFER(r);
+    WIPE_BUFFER(h_ram);
+}
+
+int crypto_check_ph(const u8 signature[64],
+                    const u8 public_key[32],
+                    const u8 digest[64])
+{
+    crypto_check_ctx ctx;
+    FOR (i, 0, 64) { ctx.sig[i] = signature [i]; }
+    FOR (i, 0, 32) { ctx.pk [i] = public_key[i]; }
+    HASH_INIT  (&ctx.hash);
+    HASH_UPDATE(&ctx.hash, ph_dom    , 34);
+    HASH_UPDATE(&ctx.hash, signature , 32);
+    HASH_UPDATE(&ctx.hash, public_key, 32);
+    HASH_UPDATE(&ctx.hash, digest    , 64);
+    return crypto_check_final(&ctx);
+}
+
+// Variable time! s must not be secret!
+// Like ge_frombytes_neg_vartime(), but rejects the encodings that can
+// never be equal to the output of ge_tobytes(): y >= p, or x == 0 with
+// the sign bit set.  Those would fail crypto_check_final().
+static int ge_frombytes_neg_canonical(ge *h, const u8 s[32])
+{
+    int y_above_p = s[0] >= 0xed && (s[31] & 0x7f) == 0x7f;
+    FOR (i, 1, 31) {
+        y_above_p &= s[i] == 0xff;
+    }
+    if (y_above_p || ge_frombytes_neg_vartime(h, s)) {
+        return -1;
+    }
+    if ((s[31] >> 7) && !fe_isnonzero(h->X)) {
+        return -1;
+    }
+    return 0;
+}
+
+// r = a * b modulo 8*L (instead of L), so that r*P == a*(b*P) even
+// for a point P with a low order component
+static void mul_mod_8L(u8 r[32], const u8 a[32], const u8 b[32])
+{
+    unsigned ab = a[0] * b[0];   // a * b modulo 8 (r may overlap b)
+    mul_add(r, a, b, zero);      // a * b modulo L
+    // add t*L, so that r == a * b modulo 8 (L == 5 mod 8, 5*5 == 1)
+    unsigned t = (5 * (ab - r[0])) & 7;
+    u64 carry = 0;
+    FOR (i, 0, 8) {
+        carry += load32_le(r + i*4) + (u64)t * L[i];
+        store32_le(r + i*4, (u32)carry);
+        carry >>= 32;
+    }
+    // No secret, no wipe
+}
+
+// Variable time! P must not be secret!
+// Returns 1 if L*P is not the neutral point (P has a low order
+// component), where cP is the look up table of P
+static int ge_has_low_order(const ge_cached cP[8])
+{
+    u8 l[32];
+    u8 z[32] = {0};
+    ge Q;
+    fe t;
+    store32_le_buf(l, L, 8);
+    ge_double_scalarmult_vartime(&Q, cP, l, z);
+    fe_sub(t, Q.Y, Q.Z);
+    return fe_isnonzero(Q.X) || fe_isnonzero(t);
+}
+
+// The work area holds the look up tables and the sliding windows
+typedef struct {
+    ge_cached lut [CRYPTO_CHECK_BATCH_MAX * 2][8];
+    i8        adds[CRYPTO_CHECK_BATCH_MAX * 2 + 1][258];
+} batch_work;
+typedef char batch_work_size_check[
+    sizeof(batch_work) <= CRYPTO_CHECK_BATCH_WORK_SIZE ? 1 : -1];
+
+// Checks that z1*(s1*B - R1 - h1*A1) + ... + zn*(sn*B - Rn - hn*An)
+// is the neutral point, where the zi are 128-bit random numbers.  All
+// the scalar multiplications are merged in a single double and add
+// ladder (interleaved sliding windows), so the doublings are shared by
+// all the signatures.
+// The random combination cannot see the low order components: they
+// may cancel each other out.  So each signature is first checked for
+// a low order component in si*B - Ri - hi*Ai, which is the low order
+// component of -Ri - (hi mod 8)*Ai: if L times that point is not the
+// neutral point, crypto_check() rejects the signature, and so does the
+// batch.  Other invalid signatures make the random combination fail
+// (except with a negligible probability), so a batch never passes when
+// crypto_check() rejects one of its signatures.  The check costs about
+// one scalar multiplication per signature.
+// zi * hi is reduced modulo 8*L, not L, so that a valid signature with
+// a low order component in Ai does not make the batch fail.
+// Variable time! Nothing is secret!
+int crypto_check_batch(const u8 *signatures[], const u8 *public_keys[],
+                       const u8 *messages[], const size_t message_sizes[],
+                       size_t nb, const u8 *random, void *work_area)
+{
+    if (nb > CRYPTO_CHECK_BATCH_MAX) {
+        return -1;
+    }
+    // the pairs (-Ai, -Ri), then the base point (no look up table).
+    // (about 100KB: not on the stack, which may be small in a thread)
+    batch_work *work = (batch_work*)work_area;
+    ge_cached (*lut)[8]  = work->lut;
+    i8        (*adds)[258] = work->adds;
+    size_t    nb_points = nb * 2;
+    i8       *b_adds    = adds[nb_points];
+    u8        sB[32] = {0};
+    ge        P, tmp;
+    fe        ta, tb;
+    FOR (i, 0, nb) {
+        const u8 *R = signatures[i];
+        const u8 *s = signatures[i] + 32;
+        u8 z[32] = {0};
+        u8 h_ram[64];
+        FOR (j, 0, 16) {
+            z[j] = random[i*16 + j];
+        }
+        z[15] |= 0x80; // never zero
+        if (is_above_L(s)) {
+            return -1;
+        }
+        if (ge_frombytes_neg_vartime(&P, public_keys[i])) {
+            return -1;
+        }
+        ge_precompute(lut[i*2    ], &P);
+        if (ge_frombytes_neg_canonical(&P, R)) {
+            return -1;
+        }
+        ge_precompute(lut[i*2 + 1], &P);
+
+        HASH_CTX ctx;
+        HASH_INIT  (&ctx);
+        HASH_UPDATE(&ctx, R, 32);
+        HASH_UPDATE(&ctx, public_keys[i], 32);
+        HASH_UPDATE(&ctx, messages[i], message_sizes[i]);
+        HASH_FINAL (&ctx, h_ram);
+        reduce(h_ram);
+
+        // low order component: P = -Ri - (hi mod 8)*Ai (lut: -Ai*(2j+1))
+        int h8 = h_ram[0] & 7;
+        if (h8 > 0) {
+            ge_add(&P, &P, &lut[i*2][(h8 - 1) / 2]);
+        }
+        if (h8 > 0 && h8 % 2 == 0) {
+            ge_add(&P, &P, &lut[i*2][0]);
+        }
+        ge_cached P_lut[8];
+        ge_precompute(P_lut, &P);
+        if (ge_has_low_order(P_lut)) {
+            return -1;
+        }
+
+        mul_mod_8L(h_ram, z, h_ram);         // zi * hi (below 8*L)
+        mul_add(sB, z, s, sB);               // sum of zi * si
+        slide(adds[i*2    ], h_ram, 5);
+        slide(adds[i*2 + 1], z    , 5);
+    }
+    slide(b_adds, sB, 8);
+
+    // Avoid the first doublings (zi * hi can use up to 256 bits)
+    int i = 257;
+    while (i >= 0) {
+        int all_zero = b_adds[i] == 0;
+        FOR (j, 0, nb_points) {
+            all_zero &= adds[j][i] == 0;
+        }
+        if (!all_zero) {
+            break;
+        }
+        i--;
+    }
+    // Merged double and add ladder
+    ge_zero(&P);
+    while (i >= 0) {
+        ge_double(&P, &P, &tmp);
+        FOR (j, 0, nb_points) {
+            LUT_ADD(&P, lut[j], adds[j], i);
+        }
+        ge_madd_wnaf(&P, b_adds[i], ta, tb);
+        i--;
+    }
+    // check for the neutral point
+    fe_sub(tmp.Y, P.Y, P.Z);
+    if (fe_isnonzero(P.X) || fe_isnonzero(tmp.Y)) {
+        return -1;
+    }
+    return 0;
+    // No secret, no wipe
+}
+
 ////////////////////
 /// Key exchange ///
 ////////////////////
@@ -1983,19 +2367,28 @@ static void lock_ad_padding(crypto_lock_ctx *ctx)
     }
 }
 
-void crypto_lock_init(crypto_lock_ctx *ctx,
-                      const u8 key[32], const u8 nonce[24])
+void crypto_lock_init_derived(crypto_lock_ctx *ctx,
+                              const u8 derived_key[32], const u8 nonce[8])
 {
     u8 auth_key[64]; // "Wasting" the whole Chacha block is faster
     ctx->ad_phase     = 1;
     ctx->ad_size      = 0;
     ctx->message_size = 0;
-    crypto_chacha20_x_init(&ctx->chacha, key, nonce);
+    crypto_chacha20_init  (&ctx->chacha, derived_key, nonce);
     crypto_chacha20_stream(&ctx->chacha, auth_key, 64);
     crypto_poly1305_init  (&ctx->poly  , auth_key);
     WIPE_BUFFER(auth_key);
 }
 
+void crypto_lock_init(crypto_lock_ctx *ctx,
+                      const u8 key[32], const u8 nonce[24])
+{
+    u8 derived_key[32];
+    crypto_chacha20_H(derived_key, key, nonce);
+    crypto_lock_init_derived(ctx, derived_key, nonce + 16);
+    WIPE_BUFFER(derived_key);
+}
+
 void crypto_lock_auth_ad(crypto_lock_ctx *ctx, const u8 *msg, size_t msg_size)
 {
     crypto_poly1305_update(&ctx->poly, msg, msg_size);
@@ -58,11 +58,20 @@ typedef struct {
     uint8_t buf[96];
     uint8_t pk [32];
 } crypto_sign_ctx;
+typedef struct {
+    uint8_t a     [32]; // secret scalar
+    uint8_t prefix[32]; // secret nonce prefix
+    uint8_t pk    [32]; // public key
+} crypto_sign_key;
 typedef struct {
     crypto_hash_ctx hash;
     uint8_t sig[64];
     uint8_t pk [32];
 } crypto_check_ctx;
+typedef struct {
+    uint8_t pk [32];
+    int32_t lut[8][40]; // multiples of the decompressed public key
+} crypto_check_key;
 
 
 ////////////////////////////
@@ -138,6 +147,16 @@ void crypto_unlock_update(crypto_unlock_ctx *ctx,
                           size_t             text_size);
 int crypto_unlock_final(crypto_unlock_ctx *ctx, const uint8_t mac[16]);
 
+// Incremental interface with a derived key
+// crypto_lock_init() derives a key from the key and the first 16 bytes
+// of the nonce (crypto_chacha20_H()). Messages whose nonces share these
+// 16 bytes can derive it once, then call crypto_lock_init_derived()
+// with the last 8 bytes of each nonce.
+void crypto_lock_init_derived(crypto_lock_ctx *ctx,
+                              const uint8_t    derived_key[32],
+                              const uint8_t    nonce[8]);
+#define crypto_unlock_init_derived crypto_lock_init_derived
+
 
 // General purpose hash (Blake2b)
 // ------------------------------
@@ -211,6 +230,24 @@ void crypto_sign_init_second_pass(crypto_sign_ctx *ctx);
 // use crypto_sign_update() again.
 void crypto_sign_final(crypto_sign_ctx *ctx, uint8_t signature[64]);
 
+// Signatures with an expanded secret key
+// crypto_sign_key_init() hashes the secret key and computes the public
+// key once. The key must be wiped after use.
+void crypto_sign_key_init(crypto_sign_key *key,
+                          const uint8_t    secret_key[32]);
+void crypto_sign_init_first_pass_key(crypto_sign_ctx       *ctx,
+                                     const crypto_sign_key *key);
+void crypto_sign_with_key(uint8_t                signature[64],
+                          const crypto_sign_key *key,
+                          const uint8_t *message, size_t message_size);
+// Signs nb messages at once (faster than nb calls to
+// crypto_sign_with_key(), the signatures are the same)
+void crypto_sign_many_with_key(uint8_t               *signatures, // 64 * nb
+                               const crypto_sign_key *key,
+                               const uint8_t         *messages[],
+                               const size_t           message_sizes[],
+                               size_t                 nb);
+
 // Incremental interface for verification (1 pass)
 void crypto_check_init  (crypto_check_ctx *ctx,
                          const uint8_t signature[64],
@@ -219,6 +256,49 @@ void crypto_check_update(crypto_check_ctx *ctx,
                          const uint8_t *message, size_t message_size);
 int crypto_check_final  (crypto_check_ctx *ctx);
 
+// Verification with a precomputed public key
+// The public key is decompressed once by crypto_check_key_init(),
+// which returns -1 if it is invalid. crypto_check_final_key() is used
+// instead of crypto_check_final(), after
+// crypto_check_init(ctx, signature, key->pk).
+int crypto_check_key_init (crypto_check_key *key,
+                           const uint8_t public_key[32]);
+int crypto_check_final_key(crypto_check_ctx *ctx,
+                           const crypto_check_key *key);
+int crypto_check_with_key (const uint8_t  signature[64],
+                           const crypto_check_key *key,
+                           const uint8_t *message, size_t message_size);
+
+// Prehashed signatures (in the spirit of Ed25519ph)
+// The message is hashed first with crypto_blake2b() (64 byte digest,
+// no key), in a single pass, then the digest is signed.  Prehashed
+// signatures use a domain separator: they are not valid signatures of
+// the message, or of the digest, for crypto_check().
+void crypto_sign_ph_with_key(uint8_t                signature[64],
+                             const crypto_sign_key *key,
+                             const uint8_t          digest[64]);
+int crypto_check_ph(const uint8_t signature [64],
+                    const uint8_t public_key[32],
+                    const uint8_t digest    [64]);
+
+// Batch verification
+// Returns 0 if all signatures are valid, -1 otherwise (then check them
+// one by one to know which ones are invalid).  random must contain
+// 16 * nb random bytes.  The work area must be at least
+// CRYPTO_CHECK_BATCH_WORK_SIZE bytes, suitably aligned (from malloc()).
+// The batch fails whenever crypto_check() rejects one of the
+// signatures, including a signature with low order components (each
+// signature is checked for them: about one scalar multiplication).
+#define CRYPTO_CHECK_BATCH_MAX 32
+#define CRYPTO_CHECK_BATCH_WORK_SIZE (100 * 1024)
+int crypto_check_batch(const uint8_t *signatures [], // 64 bytes each
+                       const uint8_t *public_keys[], // 32 bytes each
+                       const uint8_t *messages   [],
+                       const size_t   message_sizes[],
+                       size_t nb,                    // <= BATCH_MAX
+                       const uint8_t *random,
+                       void          *work_area);
+
 
 ////////////////////////////
 /// Low level primitives ///
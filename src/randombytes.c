@@ -31,6 +31,9 @@ int randombytes(unsigned char *x,unsigned long long xlen) {
 	return r;
 }	
 
+void randombytes_retain(void) { }
+void randombytes_release(void) { }
+
 #else // unix
 // ---------------------------------------------------------------------
 // use getrandom() or /dev/urandom
@@ -50,15 +53,19 @@ int randombytes(unsigned char *x,unsigned long long xlen) {
 #define HAVE_GETRANDOM (GLIBC_PREREQ(2,25) && __linux__)
 #endif
 
+#if HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
 
-int randombytes(unsigned char *x, unsigned long long xlen) {
-	int fd, i;
+
+static int os_randombytes(unsigned char *x, unsigned long long xlen) {
+	int i;
 	size_t count = (size_t) xlen;
 
 #if HAVE_GETRANDOM
 	i = getrandom(x, count, 0);
 #else
-	fd = open("/dev/urandom",O_RDONLY);
+	int fd = open("/dev/urandom",O_RDONLY);
 	if (fd == -1) { 
 		return -1; 
 	}
@@ -71,4 +78,126 @@ int randombytes(unsigned char *x, unsigned long long xlen) {
 	return 0;
 }
 
+// ---------------------------------------------------------------------
+// randombytes() - a ChaCha20 generator with fast key erasure
+
+// Each thread has its own generator. A ChaCha20 stream produces the
+// next key (first 32 bytes) and a buffer of RNG_BUFSIZE random bytes,
+// which are wiped as they are served. The previous key is overwritten
+// at once, so a compromised state does not reveal past output. Large
+// requests are served directly from the stream. The key is seeded 
+// once by the OS random generator (one syscall per thread).
+//
+// The state has its own page, marked MADV_WIPEONFORK when available: 
+// in a child process created by fork(), the page is zeroed and the 
+// generator is seeded again. Else the pid is compared on each call.
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "monocypher.h"
+
+#define RNG_BUFSIZE (1024 - 32)	// bytes of output per stream
+
+typedef struct {
+	int seeded;         	// 0: not seeded yet, or zeroed by fork()
+	int check_pid;      	// no MADV_WIPEONFORK: compare the pid
+	pid_t pid;          	// process which seeded the generator
+	size_t avail;       	// unused bytes at the end of buf
+	unsigned char key[32];
+	unsigned char buf[RNG_BUFSIZE];
+} rng_state;
+
+static __thread rng_state *rng_tls = NULL;
+static pthread_mutex_t rng_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t rng_key;	// unmaps the state when a thread exits
+static int rng_key_ok = 0;
+static int rng_refs = 0;
+
+static void rng_free(void *state) {
+	crypto_wipe(state, sizeof(rng_state));
+	munmap(state, sizeof(rng_state));
+}
+
+static rng_state *rng_get(void) {
+	// return the state of the calling thread (NULL if it cannot be
+	// allocated)
+	if (rng_tls != NULL) return rng_tls;
+	rng_state *st = mmap(NULL, sizeof(rng_state), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (st == MAP_FAILED) return NULL;
+	// the page is zeroed (not seeded)
+#ifdef MADV_DONTDUMP
+	madvise(st, sizeof(rng_state), MADV_DONTDUMP);
+#endif
+#ifdef MADV_WIPEONFORK
+	st->check_pid = madvise(st, sizeof(rng_state), MADV_WIPEONFORK) != 0;
+#else
+	st->check_pid = 1;
+#endif
+	pthread_mutex_lock(&rng_lock);
+	if (!rng_key_ok) rng_key_ok = pthread_key_create(&rng_key, rng_free) == 0;
+	if (rng_key_ok) pthread_setspecific(rng_key, st);
+	pthread_mutex_unlock(&rng_lock);
+	rng_tls = st;
+	return st;
+}
+
+static void rng_stream(rng_state *st, unsigned char *out, size_t size) {
+	// replace the key, and write size bytes of stream in out
+	static const unsigned char zero[8] = {0};
+	crypto_chacha_ctx ctx;
+	crypto_chacha20_init(&ctx, st->key, zero); // a new key each time
+	crypto_chacha20_stream(&ctx, st->key, 32);
+	crypto_chacha20_stream(&ctx, out, size);
+	crypto_wipe(&ctx, sizeof(ctx));
+}
+
+int randombytes(unsigned char *x, unsigned long long xlen) {
+	rng_state *st = rng_get();
+	if (st == NULL) return os_randombytes(x, xlen);
+	if (!st->seeded || (st->check_pid && (st->pid != getpid()))) {
+		if (os_randombytes(st->key, 32) != 0) return -1;
+		crypto_wipe(st->buf, RNG_BUFSIZE);
+		st->avail = 0;
+		st->pid = getpid();
+		st->seeded = 1;
+	}
+	while (xlen > 0) {
+		if (st->avail == 0) {
+			if (xlen >= RNG_BUFSIZE) {
+				rng_stream(st, x, xlen);
+				return 0;
+			}
+			rng_stream(st, st->buf, RNG_BUFSIZE);
+			st->avail = RNG_BUFSIZE;
+		}
+		size_t n = (xlen < st->avail) ? xlen : st->avail;
+		unsigned char *p = st->buf + RNG_BUFSIZE - st->avail;
+		memcpy(x, p, n);
+		crypto_wipe(p, n);
+		st->avail -= n;
+		x += n;
+		xlen -= n;
+	}
+	return 0;
+}
+
+void randombytes_retain(void) {
+	pthread_mutex_lock(&rng_lock);
+	rng_refs++;
+	pthread_mutex_unlock(&rng_lock);
+}
+
+void randombytes_release(void) {
+	// the thread exit destructor must be removed before the library
+	// is unloaded (the states of the other threads are then leaked)
+	pthread_mutex_lock(&rng_lock);
+	if ((--rng_refs == 0) && rng_key_ok) {
+		pthread_key_delete(rng_key);
+		rng_key_ok = 0;
+	}
+	pthread_mutex_unlock(&rng_lock);
+}
+
 #endif  // win32 or unix?
@@ -0,0 +1,213 @@
+// Copyright (c) 2018  Phil Leblanc  -- see LICENSE file
+// ---------------------------------------------------------------------
+
+// a persistent pool of native worker threads
+
+// workpool_run(fn, arg, n, grain) calls fn(arg, first, last) on
+// consecutive ranges [first, last) of at most 'grain' items, until
+// the n items have been processed. The ranges are processed by the
+// worker threads and by the calling thread. workpool_run() returns
+// when all the items have been processed.
+//
+// Only one job runs at a time. fn must not call the Lua API.
+//
+// Threads are started on the first call of workpool_run(). They are
+// stopped when the number of threads is changed, and when the last
+// user of the pool releases it (workpool_release()).
+
+#include <stddef.h>
+
+typedef void (*workpool_fn)(void *arg, size_t first, size_t last);
+
+#define WORKPOOL_MAX_THREADS 64
+#define WORKPOOL_GRAIN 16	// default number of items per range
+
+
+#ifdef _WIN32
+
+// ---------------------------------------------------------------------
+// no worker threads on windows - jobs are run by the calling thread
+
+static size_t pool_grain = WORKPOOL_GRAIN;
+
+int workpool_threads(int n) { return 0; }
+
+size_t workpool_grain(size_t grain) {
+	size_t old = pool_grain;
+	if (grain > 0) pool_grain = grain;
+	return old;
+}
+
+void workpool_run(workpool_fn fn, void *arg, size_t n, size_t grain) {
+	if (n > 0) fn(arg, 0, n);
+}
+
+void workpool_retain(void) { }
+void workpool_release(void) { }
+
+#else // unix
+// ---------------------------------------------------------------------
+// pthreads
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t pool_threads[WORKPOOL_MAX_THREADS];
+static int pool_running = 0;	// number of started threads
+static int pool_size = -1;  	// number of threads to start (-1: auto)
+static size_t pool_grain = WORKPOOL_GRAIN;
+static int pool_refs = 0;
+static int pool_stopping = 0;
+static pid_t pool_pid;      	// process which started the threads
+
+// the current job (protected by pool_lock)
+static workpool_fn job_fn;
+static void *job_arg;
+static size_t job_n, job_grain;
+static size_t job_next;     	// first item not taken yet
+static size_t job_done;     	// number of items processed
+
+static int take_range(size_t *first, size_t *last) {
+	// take the next range of the current job (called with pool_lock)
+	if (job_next >= job_n) return 0;
+	*first = job_next;
+	*last = (job_n - job_next > job_grain) ? job_next + job_grain : job_n;
+	job_next = *last;
+	return 1;
+}
+
+static void run_range(size_t first, size_t last) {
+	// process a range (called with pool_lock, which is released
+	// while fn runs)
+	workpool_fn fn = job_fn;
+	void *arg = job_arg;
+	pthread_mutex_unlock(&pool_lock);
+	fn(arg, first, last);
+	pthread_mutex_lock(&pool_lock);
+	job_done += last - first;
+	if (job_done == job_n) pthread_cond_signal(&done_cond);
+}
+
+static void *worker(void *unused) {
+	size_t first, last;
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (!pool_stopping && !take_range(&first, &last)) {
+			pthread_cond_wait(&work_cond, &pool_lock);
+		}
+		if (pool_stopping) break;
+		run_range(first, last);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return NULL;
+}
+
+static int default_size(void) {
+	// one thread per additional cpu (the calling thread also works)
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1) ncpu = 1;
+	if (ncpu > WORKPOOL_MAX_THREADS) ncpu = WORKPOOL_MAX_THREADS + 1;
+	return (int)ncpu - 1;
+}
+
+static void start_threads(void) {
+	// called with run_lock, while no job is running
+	int n = (pool_size < 0) ? default_size() : pool_size;
+	if ((pool_running > 0) && (pool_pid != getpid())) {
+		// after a fork(), the threads do not exist in the child
+		pool_running = 0;
+	}
+	pool_pid = getpid();
+	while (pool_running < n) {
+		if (pthread_create(&pool_threads[pool_running], NULL,
+				worker, NULL) != 0) break; // run with fewer threads
+		pool_running++;
+	}
+}
+
+static void stop_threads(void) {
+	// called with run_lock, while no job is running
+	if (pool_pid != getpid()) pool_running = 0;
+	if (pool_running == 0) return;
+	pthread_mutex_lock(&pool_lock);
+	pool_stopping = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&pool_lock);
+	for (int i = 0; i < pool_running; i++) {
+		pthread_join(pool_threads[i], NULL);
+	}
+	pool_running = 0;
+	pool_stopping = 0;
+}
+
+int workpool_threads(int n) {
+	// set the number of worker threads (n < 0: only return the
+	// current value). return the previous number of threads
+	pthread_mutex_lock(&run_lock);
+	int old = (pool_size < 0) ? default_size() : pool_size;
+	if (n >= 0) {
+		if (n > WORKPOOL_MAX_THREADS) n = WORKPOOL_MAX_THREADS;
+		stop_threads();
+		pool_size = n;
+	}
+	pthread_mutex_unlock(&run_lock);
+	return old;
+}
+
+size_t workpool_grain(size_t grain) {
+	// set the default number of items per range (grain == 0: only
+	// return the current value). return the previous value
+	pthread_mutex_lock(&run_lock);
+	size_t old = pool_grain;
+	if (grain > 0) pool_grain = grain;
+	pthread_mutex_unlock(&run_lock);
+	return old;
+}
+
+void workpool_run(workpool_fn fn, void *arg, size_t n, size_t grain) {
+	// grain == 0: use the default grain
+	size_t first, last;
+	if (n == 0) return;
+	pthread_mutex_lock(&run_lock);
+	if (grain == 0) grain = pool_grain;
+	if (n <= grain) {
+		// a single range: no need to wake up the workers
+		pthread_mutex_unlock(&run_lock);
+		fn(arg, 0, n);
+		return;
+	}
+	start_threads();
+	pthread_mutex_lock(&pool_lock);
+	job_fn = fn;
+	job_arg = arg;
+	job_n = n;
+	job_grain = grain;
+	job_next = job_done = 0;
+	pthread_cond_broadcast(&work_cond);
+	while (take_range(&first, &last)) run_range(first, last);
+	while (job_done < job_n) pthread_cond_wait(&done_cond, &pool_lock);
+	job_n = job_next = job_done = 0;
+	pthread_mutex_unlock(&pool_lock);
+	pthread_mutex_unlock(&run_lock);
+}
+
+void workpool_retain(void) {
+	pthread_mutex_lock(&run_lock);
+	pool_refs++;
+	pthread_mutex_unlock(&run_lock);
+}
+
+void workpool_release(void) {
+	// the threads must be stopped before the library is unloaded
+	pthread_mutex_lock(&run_lock);
+	if (--pool_refs == 0) stop_threads();
+	pthread_mutex_unlock(&run_lock);
+}
+
+#endif  // win32 or unix?
@@ -61,10 +61,50 @@ local function px(s, msg)
 	print(stohex(s, 16, " ")) 
 end
 
+local function flip(s, i) 
+	-- return s with the low bit of byte i inverted
+	-- (no bitwise operators: the tests also run with Lua 5.1)
+	local b = s:byte(i)
+	b = (b % 2 == 0) and b + 1 or b - 1
+	return s:sub(1, i - 1) .. char(b) .. s:sub(i + 1) 
+end
+
+local function le64(x)
+	-- 8-byte little endian encoding of integer x (0 <= x < 2^53)
+	-- (string.pack is not available before Lua 5.3)
+	local t = {}
+	for i = 1, 8 do
+		t[i] = char(x % 256)
+		x = math.floor(x / 256)
+	end
+	return concat(t)
+end
+
 print("------------------------------------------------------------")
 print(_VERSION, na.VERSION )
 print("------------------------------------------------------------")
 
+------------------------------------------------------------------------
+-- randombytes
+
+print("testing randombytes...")
+
+assert(na.randombytes(0) == "")
+for _, n in ipairs{1, 31, 32, 257, 991, 992, 993, 5000, 100000} do
+	local r = na.randombytes(n)
+	assert(#r == n)
+end
+-- no repeated output, including across refills of the generator buffer
+local seen = {}
+for i = 1, 2000 do
+	local r = na.randombytes(16)
+	assert(not seen[r]); seen[r] = true
+end
+local r = na.randombytes(100000)
+assert(r:sub(1, 32) ~= r:sub(-32))
+assert(na.randombytes(100000) ~= r)
+assert(na.randombytes(-1) == nil)
+
 ------------------------------------------------------------------------
 -- lock/unlock tests
 
@@ -147,6 +187,274 @@ n2 = c:sub(1,24)
 m2 = na.unlock(k, n2, c, #n2)
 assert(m2 == m)
 
+-- truncated or empty encrypted text, bad offsets
+assert(na.unlock(k, n, "") == nil)
+assert(na.unlock(k, n, c:sub(1, 15)) == nil)
+assert(na.unlock(k, n, c, #c - 15) == nil)
+assert(na.unlock(k, n, c, #c + 1) == nil)
+assert(na.unlock(k, n, c, -1) == nil)
+assert(na.unlock(k, n, na.lock(k, n, "")) == "")
+
+-- large messages (the result is built in a Lua buffer)
+m = ("abcdefgh"):rep(131072) -- 1 MB
+c = na.lock(k, n, m, n)
+assert(#c == #m + 16 + 24 and c:sub(1, 24) == n)
+assert(na.unlock(k, n, c, 24) == m)
+
+-- lock_aead / unlock_aead
+-- xchacha20-poly1305 test vector from draft-irtf-cfrg-xchacha-03, A.3.1
+k = hextos[[ 
+	808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f ]]
+n = hextos[[ 404142434445464748494a4b4c4d4e4f5051525354555657 ]]
+ad = hextos[[ 50515253c0c1c2c3c4c5c6c7 ]]
+m = "Ladies and Gentlemen of the class of '99: If I could offer you "
+	.. "only one tip for the future, sunscreen would be it."
+e = hextos[[
+	bd6d179d3e83d43b9576579493c0e939572a1700252bfaccbed2902c21396cbb
+	731c7f1b0b4aa6440bf3a82f4eda7e39ae64c6708c54c216cb96b72e1213b452
+	2f8c9ba40db5d945b11b69b982c1bb9e3f3fac2bc369488f76b2383565d3fff9
+	21f9664c97637da9768812f615c68b13b52e
+	c0875924c1c7987947deafd8780acf49
+	]]
+c = na.lock_aead(k, n, m, ad)
+assert(c:sub(17) .. c:sub(1, 16) == e)
+assert(na.unlock_aead(k, n, c, ad) == m)
+-- empty ad: same as lock()
+assert(na.lock_aead(k, n, m, "") == na.lock(k, n, m))
+-- prefix and offset
+c = na.lock_aead(k, n, m, ad, n)
+assert(c:sub(1, 24) == n and #c == 24 + 16 + #m)
+assert(na.unlock_aead(k, n, c, ad, 24) == m)
+-- wrong ad, truncated text
+assert(na.unlock_aead(k, n, c, ad .. "x", 24) == nil)
+assert(na.unlock_aead(k, n, c, "", 24) == nil)
+assert(na.unlock_aead(k, n, c:sub(1, 39), ad, 24) == nil)
+assert(na.unlock_aead(k, n, na.buffer(c), na.buffer(ad), 24) == m)
+
+-- buffers
+b = na.buffer(8)
+assert(#b == 8 and tostring(b) == ("\0"):rep(8))
+b = na.buffer("hello world")
+assert(#b == 11 and tostring(b) == "hello world")
+assert(b:sub(1, 5) == "hello" and b:sub(-5) == "world")
+assert(b:sub(7) == "world" and b:sub(5, 4) == "" and b:sub(-100, 100) == tostring(b))
+if math.mininteger then -- (Lua 5.3+)
+	assert(b:sub(math.mininteger) == tostring(b))
+	assert(b:sub(1, math.mininteger) == "")
+end
+assert(b:set(1, "J"):sub(1, 5) == "Jello")
+assert(not pcall(b.set, b, 11, "ab"))
+assert(not pcall(na.buffer, -1))
+assert(tostring(b:wipe()) == ("\0"):rep(11))
+
+-- buffers as input
+m = "Ladies and Gentlemen of the class of '99"
+c = na.lock(k, n, m, n)
+assert(na.lock(na.buffer(k), na.buffer(n), na.buffer(m), na.buffer(n)) == c)
+assert(na.unlock(k, n, na.buffer(c), 24) == m)
+assert(na.blake2b(na.buffer(m)) == na.blake2b(m))
+assert(not pcall(na.blake2b, {}))
+
+-- encryption and decryption in place
+-- (one buffer reused for all the packets: nonce, mac, text)
+b = na.buffer(24 + 16 + 100)
+for i = 1, 10 do
+	local pm = ("x"):rep(i * 7)
+	local pn = na.randombytes(24)
+	b:set(1, pn):set(24 + 16 + 1, pm)
+	local j = na.lock_into(k, pn, b, 24, #pm)
+	assert(j == 24 + 16 + #pm)
+	local packet = b:sub(1, j)
+	assert(packet == na.lock(k, pn, pm, pn))
+	b:wipe():set(1, packet)
+	assert(na.unlock_into(k, b:sub(1, 24), b, 24, #packet - 24) == #pm)
+	assert(b:sub(24 + 16 + 1, j) == pm)
+end
+-- invalid mac: the buffer is unchanged
+b:set(1, c)
+b:set(30, "X")
+local before = tostring(b)
+assert(na.unlock_into(k, n, b, 24, #c - 24) == nil)
+assert(tostring(b) == before)
+assert(na.unlock_into(k, n, b, 0, 15) == nil)
+assert(not pcall(na.lock_into, k, n, b, #b - 15, 0))
+assert(not pcall(na.unlock_into, k, n, b, 1, #b))
+
+-- lock_many / unlock_many
+k = na.randombytes(32)
+local prefix = na.randombytes(16)
+local ns, ms = {}, {}
+for i = 1, 40 do
+	-- nonces with a common prefix, and a few random nonces
+	ns[i] = (i % 7 == 0) and na.randombytes(24) or prefix .. le64(i)
+	ms[i] = na.randombytes(i * 13)
+end
+cs = na.lock_many(k, ns, ms)
+assert(#cs == 40)
+for i = 1, 40 do assert(cs[i] == na.lock(k, ns[i], ms[i])) end
+local ms2, nerr = na.unlock_many(k, ns, cs)
+assert(nerr == 0 and #ms2 == 40)
+for i = 1, 40 do assert(ms2[i] == ms[i]) end
+cs[3] = cs[3]:sub(1, -2) .. "x"
+cs[10] = "short"
+cs[11] = cs[12]
+ms2, nerr = na.unlock_many(k, ns, cs)
+assert(nerr == 3 and #ms2 == 40)
+for i = 1, 40 do
+	if i == 3 or i == 10 or i == 11 then assert(ms2[i] == false)
+	else assert(ms2[i] == ms[i]) end
+end
+assert(#na.lock_many(k, {}, {}) == 0)
+assert(not pcall(na.lock_many, k, {n}, {}))
+assert(not pcall(na.lock_many, k, {"short"}, {"m"}))
+assert(not pcall(na.unlock_many, "short", {n}, {"m"}))
+
+-- nonce sequences
+seq = na.nonce_sequence(prefix, 0)
+assert(seq:prefix() == prefix)
+assert(seq:counter() == 0)
+assert(seq:next() == prefix .. le64(0))
+assert(seq:next() == prefix .. le64(1))
+assert(seq:counter() == 2)
+m = "hello"
+c = na.lock_auto(k, seq, m)
+assert(c == na.lock(k, prefix .. le64(2), m, prefix .. le64(2)))
+assert(na.unlock(k, c:sub(1, 24), c, 24) == m)
+assert(na.lock_auto(k, seq, m) ~= na.lock_auto(k, seq, m))
+assert(#na.nonce_sequence():prefix() == 16)
+assert(na.nonce_sequence():prefix() ~= na.nonce_sequence():prefix())
+assert(na.nonce_sequence():counter() == 0)
+c = na.lock_auto(k, seq, na.buffer(m))
+assert(na.unlock(k, c:sub(1, 24), c, 24) == m)
+-- resume the sequence where it stopped
+local i = seq:counter()
+local seq2 = na.nonce_sequence(seq:prefix(), i)
+assert(seq2:next() == prefix .. le64(i))
+assert(seq2:counter() == i + 1)
+assert(na.nonce_sequence(prefix, 1000):next() == prefix .. le64(1000))
+-- a prefix requires a start counter
+assert(not pcall(na.nonce_sequence, prefix))
+assert(not pcall(na.nonce_sequence, prefix, -1))
+assert(not pcall(na.nonce_sequence, "short", 0))
+if math.maxinteger then
+	-- the counter passes the largest Lua integer
+	seq2 = na.nonce_sequence(prefix, math.maxinteger)
+	assert(seq2:counter() == math.maxinteger)
+	assert(seq2:next() == prefix .. ("\255"):rep(7) .. "\127")
+	assert(not pcall(seq2.counter, seq2))
+end
+assert(not pcall(na.lock_auto, k, prefix, m))
+assert(not pcall(na.lock_auto, "short", seq, m))
+
+-- encrypted streams
+k = na.randombytes(32)
+enc, hdr = na.encryptor(k)
+assert(#hdr == 24)
+local chunks, texts = {}, {}
+for i = 1, 10 do
+	texts[i] = na.randombytes(i * 10)
+	local tag = (i == 4) and "rekey" or (i == 6) and "push" or nil
+	chunks[i] = enc:update(texts[i], tag, (i == 2) and "hdr" or nil)
+	assert(#chunks[i] == #texts[i] + 17)
+end
+chunks[11] = enc:final("end")
+assert(enc:finished())
+assert(not pcall(enc.update, enc, "more"))
+-- same text, different chunks
+enc2 = na.encryptor(k)
+assert(enc2:update("abc") ~= enc2:update("abc"))
+-- decryption in order
+dec = na.decryptor(k, hdr)
+for i = 1, 10 do
+	local m, tag = dec:update(chunks[i], (i == 2) and "hdr" or nil)
+	assert(m == texts[i])
+	assert(tag == ((i == 4) and "rekey" or (i == 6) and "push" or "message"))
+	assert(not dec:finished())
+end
+assert(select(2, dec:update(chunks[11])) == "final")
+assert(dec:finished())
+assert(dec:update(chunks[11]) == nil)
+-- reordered, dropped, replayed, modified chunks, wrong ad or header
+dec = na.decryptor(k, hdr)
+assert(dec:update(chunks[2]) == nil)          -- reordered / dropped
+assert(dec:update(chunks[1]) == texts[1])     -- state unchanged
+assert(dec:update(chunks[1]) == nil)          -- replayed
+assert(dec:update(chunks[2]) == nil)          -- missing ad
+assert(dec:update(chunks[2], "HDR") == nil)   -- wrong ad
+local bad = chunks[2]:sub(1, 16) .. "x" .. chunks[2]:sub(18)
+assert(dec:update(bad, "hdr") == nil)         -- modified tag
+assert(dec:update(chunks[2]:sub(1, 16), "hdr") == nil)
+assert(dec:update(chunks[2], "hdr") == texts[2])
+assert(na.decryptor(k, na.randombytes(24)):update(chunks[1]) == nil)
+-- truncation is detected: all the chunks are valid but the last
+dec = na.decryptor(k, hdr)
+for i = 1, 10 do assert(dec:update(chunks[i], (i == 2) and "hdr" or nil)) end
+assert(not dec:finished())
+-- bad arguments
+enc = na.encryptor(k)
+assert(not pcall(na.decryptor, k, "short"))
+assert(not pcall(na.encryptor, "short"))
+assert(not pcall(enc.update, enc, "m", "bad tag"))
+assert(not pcall(enc.finished, na.buffer(1)))
+
+-- parallel encryption (force a few worker threads)
+nthreads = na.workpool(3)
+k, n = na.randombytes(32), na.randombytes(24)
+for _, size in ipairs{0, 1, 63, 64, 65, 1000, 64 * 100 + 5} do
+	m = na.randombytes(size)
+	c = na.lock_parallel(k, n, m, 64)
+	local nchunks = (size == 0) and 1 or math.floor((size + 63) / 64)
+	assert(#c == 16 + size + 16 * nchunks)
+	assert(na.unlock_parallel(k, n, c) == m)
+end
+m = na.randombytes(250000)
+c = na.lock_parallel(k, n, m)  -- default chunk size (64 KB)
+assert(#c == 16 + #m + 16 * 4)
+assert(na.unlock_parallel(k, n, c) == m)
+assert(na.lock_parallel(k, n, m) == c) -- deterministic
+-- modified chunk, header, truncated or extended text
+assert(na.unlock_parallel(k, n, flip(c, 100000)) == nil)
+assert(na.unlock_parallel(k, n, flip(c, 1)) == nil)  -- length
+assert(na.unlock_parallel(k, n, flip(c, 9)) == nil)  -- chunk size
+assert(na.unlock_parallel(k, n, c:sub(1, -2)) == nil)
+assert(na.unlock_parallel(k, n, c .. "x") == nil)
+assert(na.unlock_parallel(k, n, "") == nil)
+assert(na.unlock_parallel(na.randombytes(32), n, c) == nil)
+-- chunks cannot be dropped: a shorter valid text has another header
+c = na.lock_parallel(k, n, ("a"):rep(640), 64)
+local c9 = c:sub(1, 16 + 9 * 80)
+assert(na.unlock_parallel(k, n, c9) == nil)
+assert(not pcall(na.lock_parallel, k, n, m, 16))
+na.workpool(nthreads)
+
+-- secret key handles
+local kcount = na.key_arena()
+k = na.randombytes(32)
+kh = na.key(k)
+assert(kh:export() == k)
+assert(na.key_arena() == kcount + 1)
+n, m = na.randombytes(24), "key handle test"
+c = na.lock(kh, n, m)
+assert(c == na.lock(k, n, m))
+assert(na.unlock(kh, n, c) == m)
+assert(na.lock_aead(kh, n, m, "ad") == na.lock_aead(k, n, m, "ad"))
+assert(na.key(kh):export() == k)
+assert(#na.key():export() == 32 and na.key():export() ~= na.key():export())
+assert(not pcall(na.key, "short"))
+kh:wipe()
+collectgarbage(); collectgarbage() -- temporary keys
+assert(na.key_arena() == kcount)
+assert(not pcall(kh.export, kh))
+assert(not pcall(na.lock, kh, n, m))
+kh:wipe() -- no effect
+-- many keys (several arena chunks), released by the gc
+local keys = {}
+for i = 1, 1000 do keys[i] = na.key() end
+assert(na.key_arena() == kcount + 1000)
+keys = nil
+collectgarbage(); collectgarbage()
+assert(na.key_arena() == kcount)
+
 ------------------------------------------------------------------------
 -- blake2b tests
 
@@ -210,6 +518,55 @@ k1 = na.key_exchange(ask, bpk)
 k2 = na.key_exchange(bsk, apk)
 assert(k1 == k2)
 
+-- secret keys and session keys as key handles
+cpk, csk = na.x25519_keypair(true)
+assert(#cpk == 32 and type(csk) == "userdata")
+assert(na.x25519_public_key(csk) == cpk)
+kh = na.key_exchange(csk, apk, true)
+assert(type(kh) == "userdata")
+assert(kh:export() == na.key_exchange(ask, cpk))
+
+-- shared key cache
+kc = na.key_cache(2)
+assert(kc:key_exchange(ask, bpk) == k1)
+assert(kc:key_exchange(ask, bpk) == k1)
+assert(kc:key_exchange(bsk, apk) == k1)
+cpk, csk = na.x25519_keypair()
+k3 = kc:key_exchange(ask, cpk) -- evicts (ask, bpk)
+assert(k3 == na.key_exchange(csk, apk))
+hits, misses, count = kc:stats()
+assert(hits == 1 and misses == 3 and count == 2)
+assert(kc:key_exchange(ask, bpk) == k1) -- evicted: miss
+assert(kc:invalidate(ask, cpk))
+assert(not kc:invalidate(ask, cpk))
+assert(kc:invalidate())
+hits, misses, count = kc:stats()
+assert(hits == 1 and misses == 4 and count == 0)
+
+-- key pair pools (refilled by a background thread)
+assert(select(3, na.keypair_pool(8)) == 0)
+c0 = os.clock()
+repeat count = select(3, na.keypair_pool()) 
+until count == 16 or os.clock() - c0 > 10
+assert(count == 16)
+seen = {}
+for i = 1, 12 do
+	local pk, sk = na.x25519_keypair()
+	assert(pk == na.x25519_public_key(sk) and not seen[sk])
+	seen[sk] = true
+	pk, sk = na.sign_keypair()
+	assert(pk == na.sign_public_key(sk) and not seen[sk])
+	seen[sk] = true
+end
+hits, misses, count = na.keypair_pool(0)     -- disable, wipe the pools
+assert(hits + misses == 24 and hits >= 16)
+hits, misses, count = na.keypair_pool()
+assert(hits == 0 and misses == 0 and count == 0)
+assert(na.x25519_keypair() and na.sign_keypair())
+assert(select(2, na.keypair_pool()) == 0)    -- disabled: no stats
+assert(not pcall(na.keypair_pool, -1))
+assert(not pcall(na.keypair_pool, 1 + 2^16))
+
 
 ------------------------------------------------------------------------
 -- ed25519 signature tests
@@ -220,6 +577,9 @@ t = "The quick brown fox jumps over the lazy dog"
 
 pk, sk = na.sign_keypair() -- signature keypair
 assert(pk == na.sign_public_key(sk))
+local kpk, ksk = na.sign_keypair(true)
+assert(na.sign_public_key(ksk) == kpk)
+assert(na.sign(ksk, kpk, "m") == na.sign(ksk:export(), kpk, "m"))
 
 sig = na.sign(sk, pk, t)
 assert(#sig == 64)
@@ -231,6 +591,296 @@ assert(na.check(sig, pk, t))
 -- modified text doesn't check
 assert(not na.check(sig, pk, t .. "!"))
 
+-- scalar arithmetic mod L: signatures frozen from the byte-wise
+-- implementation, random round trips, and s >= L is rejected
+do
+	local sigs = {}
+	for i = 1, 200 do
+		local sk = na.blake2b("scalar" .. i):sub(1, 32)
+		local pk = na.sign_public_key(sk)
+		sigs[i] = na.sign(sk, pk, ("\255"):rep(i))
+	end
+	assert(sigs[1] == hextos[[
+		61636f412609338ace297071b77bc7a4e1b8e9e4053093f6847598952687b7bb
+		6ee119cf07e67c34572d411ed9967a33d8deccf2e60aa2052c92f18b9d229a07
+		]])
+	assert(na.blake2b(concat(sigs)) == hextos[[
+		6b9fe6ba28c5783573cc60b7c84e34f9721e63653e389d5152ccd74f22703541
+		9b536f40e3f33e2a38c9f579d641c36e9cabff8522a3104b87979fa7aedfec38
+		]])
+	for i = 1, 100 do
+		local pk, sk = na.sign_keypair()
+		local m = na.randombytes(i)
+		assert(na.check(na.sign(sk, pk, m), pk, m))
+	end
+	-- add L to s: same value mod L, must not check
+	local L = hextos[[
+		edd3f55c1a631258d69cf7a2def9de14
+		00000000000000000000000000000010
+		]]
+	local sig = na.sign(sk, pk, t)
+	local s, carry = {}, 0
+	for i = 1, 32 do
+		local x = byte(sig, 32 + i) + byte(L, i) + carry
+		s[i], carry = char(x % 256), math.floor(x / 256)
+	end
+	assert(carry == 0)
+	assert(not na.check(sig:sub(1, 32) .. concat(s), pk, t))
+end
+
+-- signer objects
+s = na.signer(sk)
+assert(s:public_key() == pk)
+assert(s:sign(t) == sig)
+assert(na.check(s:sign(t .. "!"), pk, t .. "!"))
+
+-- batch verification
+sigs, pks, ms = {}, {}, {}
+for i = 1, 40 do
+	local pk, sk = na.sign_keypair()
+	local m = t .. i
+	sigs[i], pks[i], ms[i] = na.sign(sk, pk, m), pk, m
+end
+r = na.check_batch(sigs, pks, ms)
+assert(#r == 40)
+for i = 1, 40 do assert(r[i] == true) end
+ms[3] = ms[3] .. "!"
+ms[37] = ms[37] .. "!"
+sigs[20] = sigs[20]:sub(1, 32) .. sigs[21]:sub(33)
+r = na.check_batch(sigs, pks, ms)
+for i = 1, 40 do assert(r[i] == (i ~= 3 and i ~= 20 and i ~= 37)) end
+assert(#na.check_batch({}, {}, {}) == 0)
+assert(not pcall(na.check_batch, {sigs[1]}, {pks[1]}, {12})) -- no numbers
+
+-- verifier key store
+ksname = os.tmpname()
+os.remove(ksname)
+kpks, ksks = {}, {}
+for i = 1, 10 do kpks[i], ksks[i] = na.sign_keypair() end
+kst = na.randombytes(32)                         -- store key
+assert(select(2, na.keystore(kst, ksname)))     -- no file
+n, added = na.keystore_build(kst, ksname, 
+	{kpks[1], kpks[2], kpks[3], kpks[1]})
+assert(n == 3 and added == 3)
+n, added = na.keystore_build(kst, ksname, kpks) -- incremental
+assert(n == 10 and added == 7)
+ks = assert(na.keystore(kst, ksname))
+assert(ks:count() == 10)
+for i = 1, 10 do
+	local v = assert(ks:verifier(kpks[i]))
+	local m = t .. i
+	assert(v:public_key() == kpks[i])
+	assert(v:check(na.sign(ksks[i], kpks[i], m), m))
+	assert(not v:check(na.sign(ksks[i], kpks[i], m), m .. "!"))
+end
+v = ks:verifier(kpks[5])
+ks = nil; collectgarbage(); collectgarbage()  -- v keeps the store open
+assert(v:check(na.sign(ksks[5], kpks[5], t), t))
+kbad = na.randombytes(32)
+while na.verifier(kbad) do kbad = na.randombytes(32) end
+r, msg = na.keystore_build(kst, ksname, {pk, kbad})
+assert(r == nil and msg == "invalid public key (#2)")
+assert(not pcall(na.keystore_build, kst, ksname, {pk:sub(2)}))
+assert(not pcall(na.keystore, "short", ksname))
+ks = assert(na.keystore(kst, ksname))
+assert(ks:count() == 10)
+assert(select(2, ks:verifier(pk)) == "unknown public key")
+-- wrong key, corrupted store
+r, msg = na.keystore(na.randombytes(32), ksname)
+assert(r == nil and msg:find("authentication"))
+fh = assert(io.open(ksname, "rb")); ksdata = fh:read("*a"); fh:close()
+fh = assert(io.open(ksname, "wb"))
+fh:write(flip(ksdata, 101))
+fh:close()
+r, msg = na.keystore(kst, ksname)
+assert(r == nil and msg:find("authentication"))
+-- (the opened store is a private copy of the file)
+assert(ks:verifier(kpks[5]):check(na.sign(ksks[5], kpks[5], t), t))
+fh = assert(io.open(ksname, "wb")); fh:write(ksdata:sub(1, 1000)); fh:close()
+assert(select(2, na.keystore(kst, ksname)))
+assert(select(2, na.keystore_build(kst, ksname, kpks)))
+os.remove(ksname)
+
+-- parallel signature and verification (force a few worker threads)
+nthreads, grain = na.workpool(3, 4)
+s = na.signer(sk)
+ms = {}
+for i = 1, 50 do ms[i] = t .. i end
+sigs = na.sign_many(s, ms)
+assert(#sigs == 50)
+for i = 1, 50 do assert(sigs[i] == s:sign(ms[i])) end
+ts = {}
+for i = 1, 50 do ts[i] = {sigs[i], pk, ms[i]} end
+ts[7] = {sigs[7], pk, ms[8]}
+ts[50] = {sigs[49], pk, ms[50]}
+r = na.check_many(ts)
+assert(#r == 50)
+for i = 1, 50 do assert(r[i] == (i ~= 7 and i ~= 50)) end
+assert(#na.sign_many(s, {}) == 0 and #na.check_many({}) == 0)
+assert(not pcall(na.check_many, {{sigs[1], pk}}))
+assert(not pcall(na.check_many, {{sigs[1]:sub(2), pk, ms[1]}}))
+-- numbers are not accepted in the lists
+assert(not pcall(na.sign_many, s, {"a", 12}))
+assert(not pcall(na.check_many, {{sigs[1], pk, 12}}))
+assert(select(2, na.workpool(nthreads, grain)) == 4)
+-- multi-buffer signing on the calling thread (groups of 8 lanes)
+nthreads = na.workpool(0)
+ms = {""}
+for i = 2, 19 do ms[i] = ms[i-1] .. char(i) end
+sigs = na.sign_many(s, ms)
+for i = 1, 19 do assert(sigs[i] == s:sign(ms[i])) end
+na.workpool(nthreads)
+
+-- seekable encrypted files
+fname = os.tmpname()
+k = na.randombytes(32)
+ft = na.randombytes(250):rep(400) .. "end" -- 100003 bytes
+assert(na.seekfile_write(k, fname, ft))
+fh = assert(io.open(fname, "rb")); fdata = fh:read("*a"); fh:close()
+assert(#fdata == 64 + #ft + 16 * 25)
+sf = assert(na.seekfile(k, fname))
+assert(sf:size() == #ft)
+for _, r in ipairs{{0, 10}, {4090, 20}, {4096, 4096}, {50000, 1}, 
+		{100000, 100}, {0, 200000}, {100003, 5}, {5000, 0}} do
+	local i, n = r[1], r[2]
+	assert(sf:read(i, n) == ft:sub(i + 1, i + n))
+end
+for i = 1, 50 do
+	local off, len = math.random(0, #ft), math.random(0, 10000)
+	assert(sf:read(off, len) == ft:sub(off + 1, off + len))
+end
+assert(not pcall(sf.read, sf, -1, 1))
+sf:close()
+assert(not pcall(sf.read, sf, 0, 1))
+-- wrong key
+sf = assert(na.seekfile(na.randombytes(32), fname))
+assert(sf:read(0, 10) == nil)
+sf:close()
+-- a modified block: only the reads which cover it fail
+local function writefile(data)
+	fh = assert(io.open(fname, "wb")); fh:write(data); fh:close()
+end
+local pos = 64 + 3 * 4096 + 100
+writefile(flip(fdata, pos))
+sf = assert(na.seekfile(k, fname))
+assert(sf:read(0, 3 * 4096) == ft:sub(1, 3 * 4096))
+assert(sf:read(3 * 4096 + 200, 10) == nil)
+assert(sf:read(4 * 4096, 10) == ft:sub(4 * 4096 + 1, 4 * 4096 + 10))
+assert(sf:read(4000, 10000) == nil)
+sf:close()
+-- a modified header or MAC, a truncated file
+writefile(fdata:sub(1, 40) .. "x" .. fdata:sub(42))  -- nonce
+sf = assert(na.seekfile(k, fname))
+assert(sf:read(0, 10) == nil)
+sf:close()
+writefile(fdata:sub(1, -2) .. "x")
+sf = assert(na.seekfile(k, fname))
+assert(sf:read(#ft - 1, 1) == nil and sf:read(0, 1) == ft:sub(1, 1))
+sf:close()
+writefile(fdata:sub(1, -2))
+assert(select(2, na.seekfile(k, fname)):find("not a seekable"))
+-- a file truncated after it is opened: read error
+writefile(fdata)
+sf = assert(na.seekfile(k, fname))
+writefile(fdata:sub(1, 5000))
+assert(select(2, sf:read(0, 10)) == "read error") -- (MACs are at the end)
+assert(select(2, sf:read(50000, 10)) == "read error")
+sf:close()
+-- other block size, empty text
+assert(na.seekfile_write(k, fname, ft, 64 * 1000))
+sf = assert(na.seekfile(k, fname))
+assert(sf:read(63990, 20) == ft:sub(63991, 64010))
+sf:close()
+assert(na.seekfile_write(k, fname, ""))
+sf = assert(na.seekfile(k, fname))
+assert(sf:size() == 0 and sf:read(0, 10) == "")
+sf:close()
+assert(not pcall(na.seekfile_write, k, fname, ft, 100))
+os.remove(fname)
+assert(select(2, na.seekfile(k, fname)))
+
+-- file signature (larger than the 256 KB read buffer)
+fname = os.tmpname()
+ft = na.randombytes(200):rep(3000)
+fh = assert(io.open(fname, "wb")); fh:write(ft); fh:close()
+fsig = na.sign_file(s, fname)
+assert(fsig == s:sign(ft))
+assert(na.check_file(fsig, pk, fname) == true)
+assert(na.check_file(sig, pk, fname) == false)
+fh = assert(io.open(fname, "wb")); fh:close() -- empty file
+assert(na.sign_file(s, fname) == s:sign(""))
+assert(na.check_file(s:sign(""), pk, fname))
+os.remove(fname)
+r, msg = na.sign_file(s, fname)
+assert(r == nil and msg:find(fname, 1, true))
+r, msg = na.check_file(fsig, pk, fname)
+assert(r == nil and msg:find(fname, 1, true))
+
+-- prehashed signatures
+psig = na.sign_ph(s, t)
+assert(#psig == 64 and psig ~= sig)
+assert(na.check_ph(psig, pk, t))
+assert(not na.check_ph(psig, pk, t .. "!"))
+assert(not na.check_ph(sig, pk, t))        -- domain separation
+assert(not na.check(psig, pk, t))
+assert(not na.check(psig, pk, na.blake2b(t)))
+ctx = na.sign_ph_init(s)
+ctx:update("The quick brown "):update("fox jumps over ")
+ctx:update(""):update("the lazy dog")
+assert(ctx:final() == psig)
+assert(not pcall(ctx.final, ctx))
+assert(not pcall(ctx.update, ctx, "more"))
+ctx = na.check_ph_init(psig, pk)
+for i = 1, #t do ctx:update(t:sub(i, i)) end
+assert(ctx:final() == true)
+assert(na.check_ph_init(psig, pk):update(t .. "!"):final() == false)
+assert(not pcall(na.check_ph_init, psig:sub(2), pk))
+psk = na.blake2b("prehash"):sub(1, 32)
+assert(na.sign_ph(na.signer(psk), "") == hextos[[
+	7c678b062a2c4ca88e47e623f8536f053600062ededda863bce842e763c2de9b
+	7476fe4ea0a3448fbeb186db618d04f97a2a27aee45c19ef667ce73d3586f00d
+	]])
+
+-- check cache
+cc = na.check_cache(16)
+assert(cc:check(sig, pk, t))
+assert(cc:check(sig, pk, t))
+assert(not cc:check(sig, pk, t .. "!"))
+assert(not cc:check(sig, pk, t .. "!"))     -- failures are not cached
+hits, misses, count = cc:stats()
+assert(hits == 1 and misses == 3 and count == 1)
+for i = 1, 100 do                           -- more entries than slots
+	local m = t .. i
+	assert(cc:check(s:sign(m), pk, m))
+end
+hits, misses, count = cc:stats()
+assert(misses == 103 and count <= 16 and count >= 8)
+cc:clear()
+assert(select(3, cc:stats()) == 0)
+assert(cc:check(sig, pk, t))
+assert(select(2, cc:stats()) == 104)
+assert(not pcall(cc.check, cc, sig:sub(2), pk, t))
+
+-- verifier objects
+v = na.verifier(pk)
+assert(v:public_key() == pk)
+assert(v:check(sig, t))
+assert(not v:check(sig, t .. "!"))
+v2 = na.verifier(pk) -- served by the verifier cache
+assert(v2:check(sig, t))
+hits, misses, count = na.verifier_cache()
+assert(hits >= 1 and count >= 1)
+na.verifier_cache(0) -- disable the cache
+assert(na.verifier(pk):check(sig, t))
+hits, misses, count = na.verifier_cache(16)
+assert(hits == 0 and misses == 0 and count == 0)
+-- not a valid point
+badpk = ("\255"):rep(31) .. "\127"
+while na.verifier(badpk) do
+	badpk = na.randombytes(32)
+end
+assert(select(2, na.verifier(badpk)) == "invalid public key")
+
 
 ------------------------------------------------------------------------
 -- password derivation argon2i tests
@@ -244,6 +894,62 @@ c0 = os.clock()
 k = na.argon2i(pw, salt, 100000, 10)
 assert(#k == 32)
 print("argon2i (100MB, 10 iter) Execution time (sec): ", os.clock()-c0)
+assert(na.argon2i(pw, salt, 1000, 3, true):export() 
+	== na.argon2i(pw, salt, 1000, 3))
+
+
+------------------------------------------------------------------------
+-- asynchronous jobs
+
+print("testing async jobs...")
+
+na.async_ack()
+f = na.async("argon2i", pw, salt, 1000, 3)
+assert(f:result() == na.argon2i(pw, salt, 1000, 3))
+assert(f:done() and f:result() == f:result())
+assert(na.async_ack() == 1)
+-- several results, tables, soft and hard errors
+pk, sk = na.sign_keypair()
+assert(na.async("sign_public_key", sk):result() == pk)
+sig = na.async("sign", sk, pk, t):result()
+assert(na.async("check_batch", {sig, sig}, {pk, pk}, {t, t .. "!"})
+	:result()[2] == false)
+k, n = na.randombytes(32), na.randombytes(24)
+r, msg = na.async("unlock", k, n, "too short"):result()
+assert(r == nil and msg == "unlock error")
+f = na.async("lock", "bad key", n, t)
+r, msg = pcall(f.result, f)
+assert(not r and msg:find("bad key size"))
+-- buffers are copied as strings, keys as key handles
+c = na.async("lock", na.key(k), na.buffer(n), t):result()
+assert(c == na.lock(k, n, t))
+kh = na.async("argon2i", pw, salt, 1000, 3, true):result()
+assert(getmetatable(kh) == getmetatable(na.key()))
+assert(kh:export() == na.argon2i(pw, salt, 1000, 3))
+-- only the listed functions, only values which can be copied
+assert(not pcall(na.async, "nosuchfunction"))
+assert(not pcall(na.async, "async_threads", 2))
+assert(not pcall(na.async, "verifier_cache", 0))
+assert(not pcall(na.async, "workpool", 1))
+assert(not pcall(na.async, "encryptor", k))
+assert(not pcall(na.async, "key", k))
+assert(not pcall(na.async, "sign_keypair"))
+assert(not pcall(na.async, "check_many", {}))
+assert(not pcall(na.async, "lock_parallel", k, n, t))
+r, msg = pcall(na.async, "lock", io.stdout, n, t)
+assert(not r and msg:find("unsupported type"))
+r, msg = pcall(na.async, "blake2b", {t, {print}})
+assert(not r and msg:find("unsupported type"))
+-- many jobs, completion count, abandoned jobs
+assert(type(na.async_fd()) == "number")
+na.async_threads(2)
+fs = {}
+for i = 1, 50 do fs[i] = na.async("blake2b", t .. i) end
+na.async("argon2i", pw, salt, 1000, 3) -- collected before it is done
+collectgarbage()
+for i = 1, 50 do assert(fs[i]:result() == na.blake2b(t .. i)) end
+assert(na.async_ack() >= 50)
+na.async_threads(1)
 
 
 print("test_luanacha  ok")
@@ -0,0 +1,114 @@
+// Generates src/monocypher_tables.h, the precomputed multiples of the
+// Ed25519 base point used by src/monocypher.c
+//
+// usage: gen_tables > src/monocypher_tables.h
+//
+// The field and group arithmetic is the one of monocypher.c itself,
+// compiled without the tables.
+
+#include <stdio.h>
+
+#define MONOCYPHER_NO_TABLES
+#include "../src/monocypher.c"
+
+static void base_point(ge *B)
+{
+    static const fe X = { -14297830, -7645148, 16144683, -16471763, 27570974,
+                          -2696100, -26142465, 8378389, 20764389, 8758491 };
+    static const fe Y = { -26843541, -6710886, 13421773, -13421773, 26843546,
+                          6710886, -13421773, 13421773, -26843546, -6710886 };
+    fe_copy(B->X, X);
+    fe_copy(B->Y, Y);
+    fe_1   (B->Z);
+    fe_mul (B->T, X, Y);
+}
+
+// Reduced limbs of a field element
+static void fe_canonical(fe h)
+{
+    u8 s[32];
+    fe_tobytes(s, h);
+    fe_frombytes(h, s);
+}
+
+// Niels coordinates of P: Y+X, Y-X, 2*d*X*Y (with Z = 1)
+static void ge_niels(i32 out[30], const ge *P)
+{
+    static const fe D2 = { // - 2 * 121665 / 121666
+        -21827239, -5839606, -30745221, 13898782, 229458,
+        15978800, -12551817, -6495438, 29715968, 9444199
+    };
+    fe recip, x, y, yp, ym, t2;
+    fe_invert(recip, P->Z);
+    fe_mul(x, P->X, recip);
+    fe_mul(y, P->Y, recip);
+    fe_add(yp, y, x);
+    fe_sub(ym, y, x);
+    fe_mul(t2, x, y);
+    fe_mul(t2, t2, D2);
+    fe_canonical(yp);
+    fe_canonical(ym);
+    fe_canonical(t2);
+    FOR (i, 0, 10) {
+        out[i     ] = yp[i];
+        out[i + 10] = ym[i];
+        out[i + 20] = t2[i];
+    }
+}
+
+// 5 limbs per line
+static void print_entry(const i32 e[30])
+{
+    printf("    {");
+    FOR (i, 0, 30) {
+        printf("%d", e[i]);
+        if (i < 29) {
+            printf(i % 5 == 4 ? ",\n     " : ", ");
+        }
+    }
+    printf("},\n");
+}
+
+static void ge_add_ge(ge *s, const ge *p, const ge *q)
+{
+    ge_cached c;
+    ge_cache(&c, q);
+    ge_add(s, p, &c);
+}
+
+int main(void)
+{
+    ge B, P, row, tmp;
+    i32 e[30];
+    printf("// Generated by tools/gen_tables.c -- do not edit\n\n");
+
+    // base_table[i][j] = (j+1) * 256^i * B
+    printf("static const i32 base_table[32][8][30] = {\n");
+    base_point(&row);
+    FOR (i, 0, 32) {
+        printf("  {\n");
+        P = row;
+        FOR (j, 0, 8) {
+            ge_niels(e, &P);
+            print_entry(e);
+            ge_add_ge(&P, &P, &row);
+        }
+        printf("  },\n");
+        FOR (k, 0, 8) {
+            ge_double(&row, &row, &tmp);
+        }
+    }
+    printf("};\n\n");
+
+    // base_wnaf[i] = (2*i + 1) * B
+    printf("static const i32 base_wnaf[64][30] = {\n");
+    base_point(&P);
+    ge_double(&row, &P, &tmp); // 2B
+    FOR (i, 0, 64) {
+        ge_niels(e, &P);
+        print_entry(e);
+        ge_add_ge(&P, &P, &row);
+    }
+    printf("};\n");
+    return 0;
+}
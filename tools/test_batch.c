@@ -0,0 +1,140 @@
+// Test of crypto_check_batch() against crypto_check() on signatures
+// with low order components (made with the internal functions of
+// src/monocypher.c): the batch must pass if and only if crypto_check()
+// accepts all the signatures of the group.
+//
+// usage: test_batch [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/monocypher.c"
+
+static u64 rng_state = 0x0123456789abcdefULL;
+
+static void random_bytes(u8 *p, size_t n)
+{
+    // splitmix64
+    FOR (i, 0, n) {
+        u64 z = (rng_state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        p[i] = (u8)(z ^ (z >> 31));
+    }
+}
+
+static void random_scalar(u8 s[32])
+{
+    u8 wide[64];
+    random_bytes(wide, 64);
+    reduce(wide);
+    memcpy(s, wide, 32);
+}
+
+// P + (0, -1), the point of order 2: (x, y) -> (-x, -y)
+static void add_order2(ge *p)
+{
+    fe_neg(p->X, p->X);
+    fe_neg(p->Y, p->Y);
+}
+
+typedef struct {
+    u8 sig[64];
+    u8 pk[32];
+    u8 msg[16];
+} signature;
+
+// signature of a random message with the secret scalar a. The public
+// key is a*B, plus the point of order 2 if key_low. R is r*B, plus the
+// point of order 2 if r_low. Return 0 if crypto_check() accepts it
+static int make_signature(signature *sg, int key_low, int r_low)
+{
+    u8 a[32], r[32], h[64];
+    ge A, R;
+    random_scalar(a);
+    random_scalar(r);
+    random_bytes(sg->msg, 16);
+    ge_scalarmult_base(&A, a);
+    if (key_low) { add_order2(&A); }
+    ge_tobytes(sg->pk, &A);
+    ge_scalarmult_base(&R, r);
+    if (r_low) { add_order2(&R); }
+    ge_tobytes(sg->sig, &R);
+    HASH_CTX ctx;
+    HASH_INIT  (&ctx);
+    HASH_UPDATE(&ctx, sg->sig, 32);
+    HASH_UPDATE(&ctx, sg->pk , 32);
+    HASH_UPDATE(&ctx, sg->msg, 16);
+    HASH_FINAL (&ctx, h);
+    reduce(h);
+    mul_add(sg->sig + 32, h, a, r); // s = h*a + r
+    return crypto_check(sg->sig, sg->pk, sg->msg, 16);
+}
+
+static int failures = 0;
+
+static void fail(const char *what, long i)
+{
+    if (failures < 10) { printf("%s (case %ld)\n", what, i); }
+    failures++;
+}
+
+// check a batch of nb signatures. return the result of the batch
+static int batch(signature *sg, size_t nb, const u8 *z, void *work)
+{
+    const u8 *sigs[CRYPTO_CHECK_BATCH_MAX], *pks[CRYPTO_CHECK_BATCH_MAX];
+    const u8 *msgs[CRYPTO_CHECK_BATCH_MAX];
+    size_t    sizes[CRYPTO_CHECK_BATCH_MAX];
+    FOR (i, 0, nb) {
+        sigs[i] = sg[i].sig;
+        pks [i] = sg[i].pk;
+        msgs[i] = sg[i].msg;
+        sizes[i] = 16;
+    }
+    return crypto_check_batch(sigs, pks, msgs, sizes, nb, z, work);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = (argc > 1) ? atol(argv[1]) : 200;
+    void *work = malloc(CRYPTO_CHECK_BATCH_WORK_SIZE);
+    signature sg[8];
+    u8 z[8 * 16];
+    long rejected = 0;
+    if (work == NULL) { return 1; }
+    for (long i = 0; i < n; i++) {
+        // valid signatures, some with a public key of mixed order
+        // (accepted by crypto_check() when h is even)
+        FOR (j, 0, 8) {
+            int key_low = (j % 2 == 1);
+            while (make_signature(&sg[j], key_low, 0) != 0) { }
+        }
+        random_bytes(z, sizeof(z));
+        if (batch(sg, 8, z, work) != 0) {
+            fail("valid signatures rejected by the batch", i);
+        }
+        // one or two signatures with a low order component in R or
+        // in the public key, rejected by crypto_check() (the low order
+        // parts of R and of h*A differ by the point of order 2). Two
+        // of them would cancel each other out in the random combination.
+        size_t bad = (size_t)i % 8;
+        int r_low = (i % 4 != 3);
+        while (make_signature(&sg[bad], r_low ? bad % 2 == 1 : 1, r_low)
+               == 0) { }
+        if (i % 3 == 0) {
+            size_t bad2 = (bad + 1 + (size_t)i % 7) % 8;
+            while (make_signature(&sg[bad2], bad2 % 2 == 1, 1) == 0) { }
+        }
+        random_bytes(z, sizeof(z));
+        int r = batch(sg, 8, z, work);
+        if (r == 0) {
+            fail("signature rejected by crypto_check() accepted", i);
+        }
+        rejected += r != 0;
+    }
+    free(work);
+    printf("test_batch: %ld cases (%ld invalid batches rejected), "
+           "%d failures\n", n, rejected, failures);
+    return failures != 0;
+}
@@ -0,0 +1,170 @@
+// Differential test of the scalar arithmetic modulo L of
+// src/monocypher.c (32 bit limbs, Barrett reduction) against the
+// previous byte-wise implementation, on edge cases and random inputs
+//
+// usage: test_scalar [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/monocypher.c"
+
+///////////////////////////////////
+/// Reference (byte-wise) modL ///
+///////////////////////////////////
+
+static const u64 ref_L[32] = {
+    0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+    0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10};
+
+static void ref_modL(u8 *r, i64 x[64])
+{
+    for (unsigned i = 63; i >= 32; i--) {
+        i64 carry = 0;
+        FOR (j, i-32, i-12) {
+            x[j] += carry - 16 * x[i] * ref_L[j - (i - 32)];
+            carry = (x[j] + 128) >> 8;
+            x[j] -= carry * (1 << 8);
+        }
+        x[i-12] += carry;
+        x[i] = 0;
+    }
+    i64 carry = 0;
+    FOR (i, 0, 32) {
+        x[i] += carry - (x[31] >> 4) * ref_L[i];
+        carry = x[i] >> 8;
+        x[i] &= 255;
+    }
+    FOR (i, 0, 32) {
+        x[i] -= carry * ref_L[i];
+    }
+    FOR (i, 0, 32) {
+        x[i+1] += x[i] >> 8;
+        r[i  ]  = x[i] & 255;
+    }
+}
+
+static void ref_reduce(u8 r[64])
+{
+    i64 x[64];
+    FOR (i, 0, 64) {
+        x[i] = (u64) r[i];
+        r[i] = 0;
+    }
+    ref_modL(r, x);
+}
+
+static void ref_mul_add(u8 r[32], const u8 a[32], const u8 b[32],
+                        const u8 c[32])
+{
+    i64 s[64];
+    FOR (i,  0, 32) { s[i] = (u64) c[i]; }
+    FOR (i, 32, 64) { s[i] = 0;          }
+    FOR (i,  0, 32) {
+        FOR (j, 0, 32) {
+            s[i+j] += a[i] * (u64) b[j];
+        }
+    }
+    ref_modL(r, s);
+}
+
+static int ref_is_above_L(const u8 a[32])
+{
+    for (int i = 31; i >= 0; i--) {
+        if (a[i] > ref_L[i]) { return 1; }
+        if (a[i] < ref_L[i]) { return 0; }
+    }
+    return 1;
+}
+
+/////////////
+/// Tests ///
+/////////////
+
+static u64 rng_state = 0x0123456789abcdefULL;
+
+static void random_bytes(u8 *p, size_t n)
+{
+    // splitmix64
+    FOR (i, 0, n) {
+        u64 z = (rng_state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        p[i] = (u8)(z ^ (z >> 31));
+    }
+}
+
+// 32 byte edge cases: 0, 1, L-1, L, L+1, 2^252, all ones, ...
+static void edge_case(u8 s[32], int i)
+{
+    memset(s, 0, 32);
+    switch (i % 8) {
+    case 0: break;
+    case 1: s[0] = 1; break;
+    case 2: FOR (j, 0, 32) { s[j] = (u8)ref_L[j]; } s[0] -= 1; break;
+    case 3: FOR (j, 0, 32) { s[j] = (u8)ref_L[j]; } break;
+    case 4: FOR (j, 0, 32) { s[j] = (u8)ref_L[j]; } s[0] += 1; break;
+    case 5: s[31] = 0x10; break;
+    case 6: memset(s, 0xff, 32); break;
+    case 7: memset(s, 0xff, 32); s[31] = 0x0f; break;
+    }
+}
+
+static int failures = 0;
+
+static void check(const char *what, const u8 *a, const u8 *b, size_t n,
+                  long i)
+{
+    if (memcmp(a, b, n) != 0) {
+        if (failures < 10) { printf("%s differs (case %ld)\n", what, i); }
+        failures++;
+    }
+}
+
+static void test_one(long i, const u8 a[32], const u8 b[32],
+                     const u8 c[32], const u8 wide[64])
+{
+    u8 r1[64], r2[64];
+    memcpy(r1, wide, 64);
+    memcpy(r2, wide, 64);
+    reduce(r1);
+    ref_reduce(r2);
+    check("reduce", r1, r2, 64, i);
+
+    mul_add(r1, a, b, c);
+    ref_mul_add(r2, a, b, c);
+    check("mul_add", r1, r2, 32, i);
+
+    u8 x1 = (u8)is_above_L(a), x2 = (u8)ref_is_above_L(a);
+    check("is_above_L", &x1, &x2, 1, i);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = (argc > 1) ? atol(argv[1]) : 100000;
+    u8 a[32], b[32], c[32], wide[64];
+    // edge cases, combined
+    FOR (i, 0, 8 * 8 * 8) {
+        edge_case(a, i);
+        edge_case(b, i / 8);
+        edge_case(c, i / 64);
+        memcpy(wide, a, 32);
+        memcpy(wide + 32, b, 32);
+        test_one(i, a, b, c, wide);
+    }
+    // random inputs, also below L and with high bytes set
+    for (long i = 0; i < n; i++) {
+        random_bytes(a, 32);
+        random_bytes(b, 32);
+        random_bytes(c, 32);
+        random_bytes(wide, 64);
+        if (i % 4 == 1) { a[31] &= 0x0f; b[31] &= 0x0f; c[31] &= 0x0f; }
+        if (i % 4 == 2) { a[31] = 0x10; memset(wide + 32, 0xff, 32); }
+        test_one(i, a, b, c, wide);
+    }
+    printf("test_scalar: %ld random cases, %d failures\n", n, failures);
+    return failures != 0;
+}